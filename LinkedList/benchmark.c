@@ -0,0 +1,468 @@
+#if defined(__linux__)
+// perf_event_open, syscall and clock_gettime are not part of plain C11
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "linked_list.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define BENCH_PERF_EVENTS 1
+#endif
+
+// Micro-benchmarks for the list operations
+//
+// Every operation is set up first and then measured on its own. Around the
+// measured part the hardware counters below are read through perf_event_open,
+// and everything is reported per element, so a change that only moves cache
+// misses around shows up as such. Where the counters cannot be opened (other
+// systems, containers, perf_event_paranoid) only the wall-clock time is reported.
+//
+// usage: benchmark [elements]
+
+#define BENCH_DEFAULT_ELEMENTS 1000000
+// elements kept in the queue by the FIFO benchmarks
+#define BENCH_FIFO_DEPTH 1024
+
+typedef struct CounterSpec {
+    const char * name;
+    unsigned int type;
+    unsigned long long config;
+} CounterSpec;
+
+#if defined(BENCH_PERF_EVENTS)
+#define CACHE_READ_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const CounterSpec counter_specs[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instr", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"L1d-miss", PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {"LLC-miss", PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL)},
+    {"dTLB-miss", PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    {"br-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+#define COUNTER_COUNT (sizeof(counter_specs) / sizeof(counter_specs[0]))
+#else
+#define COUNTER_COUNT 0
+#endif
+
+// Open counters, -1 for the ones the system would not give us
+typedef struct Counters {
+    int fds[COUNTER_COUNT + 1];
+    int available;
+} Counters;
+
+// What one measured run produced
+typedef struct Measurement {
+    double seconds;
+    // counter values scaled up when the kernel had to multiplex them, -1 when unavailable
+    double values[COUNTER_COUNT + 1];
+} Measurement;
+
+static Counters counters;
+
+#if defined(BENCH_PERF_EVENTS)
+static int perf_event_open(struct perf_event_attr *attr) {
+    return (int)syscall(SYS_perf_event_open, attr, 0, -1, -1, 0);
+}
+#endif
+
+// Opens every counter that is available, for the calling thread only and in user space only
+static void counters_open(void) {
+    counters.available = 0;
+#if defined(BENCH_PERF_EVENTS)
+    for (size_t i = 0; i < COUNTER_COUNT; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counter_specs[i].type;
+        attr.config = counter_specs[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        // with more counters than the PMU has, the kernel time-slices them and these let us scale back up
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        counters.fds[i] = perf_event_open(&attr);
+        if (counters.fds[i] >= 0) counters.available++;
+    }
+#endif
+}
+
+static void counters_close(void) {
+#if defined(BENCH_PERF_EVENTS)
+    for (size_t i = 0; i < COUNTER_COUNT; i++) {
+        if (counters.fds[i] >= 0) close(counters.fds[i]);
+    }
+#endif
+}
+
+static void counters_start(void) {
+#if defined(BENCH_PERF_EVENTS)
+    for (size_t i = 0; i < COUNTER_COUNT; i++) {
+        if (counters.fds[i] < 0) continue;
+        ioctl(counters.fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(counters.fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+static void counters_stop(Measurement *measurement) {
+#if defined(BENCH_PERF_EVENTS)
+    for (size_t i = 0; i < COUNTER_COUNT; i++) {
+        if (counters.fds[i] >= 0) ioctl(counters.fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+    for (size_t i = 0; i < COUNTER_COUNT; i++) {
+        // value, time enabled, time running
+        uint64_t read_values[3];
+        measurement->values[i] = -1;
+        if (counters.fds[i] < 0) continue;
+        if (read(counters.fds[i], read_values, sizeof(read_values)) != (ssize_t)sizeof(read_values)) continue;
+        if (read_values[2] == 0) continue;
+        measurement->values[i] = (double)read_values[0] * (double)read_values[1] / (double)read_values[2];
+    }
+#else
+    (void)measurement;
+#endif
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+#if defined(BENCH_PERF_EVENTS)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// A benchmark: setup builds what op needs and is not measured, op is, teardown cleans up.
+// elements is what the results are divided by.
+typedef struct Benchmark {
+    const char * name;
+    void (*setup)(void);
+    void (*op)(void);
+    void (*teardown)(void);
+} Benchmark;
+
+// Shared state of the benchmarks
+static size_t element_count;
+static int * values;
+// values visited in a random order, so payloads are scattered like they are in real lists
+static int ** scattered;
+static LinkedList * list;
+static ListDeque * deque;
+static ListArena * arena;
+static ListLruCache * lru;
+// URL-like strings for the string sorts, all in one buffer
+static char * url_buffer;
+// keeps the compiler from dropping loops whose result is unused
+static volatile long long sink;
+
+static void print_header(void) {
+    printf("%-28s %10s", "operation (per element)", "ns");
+#if defined(BENCH_PERF_EVENTS)
+    for (size_t i = 0; i < COUNTER_COUNT; i++) {
+        printf(" %10s", counter_specs[i].name);
+    }
+#endif
+    printf("\n");
+}
+
+static void run_benchmark(const Benchmark *benchmark) {
+    Measurement measurement;
+    if (benchmark->setup != NULL) benchmark->setup();
+
+    counters_start();
+    double start = now_seconds();
+    benchmark->op();
+    measurement.seconds = now_seconds() - start;
+    counters_stop(&measurement);
+
+    double per = (double)element_count;
+    printf("%-28s %10.2f", benchmark->name, measurement.seconds * 1e9 / per);
+#if defined(BENCH_PERF_EVENTS)
+    for (size_t i = 0; i < COUNTER_COUNT; i++) {
+        if (measurement.values[i] < 0) {
+            printf(" %10s", "n/a");
+        } else {
+            printf(" %10.3f", measurement.values[i] / per);
+        }
+    }
+#endif
+    printf("\n");
+
+    if (benchmark->teardown != NULL) benchmark->teardown();
+}
+
+// Benchmark bodies
+
+static void fill_list(void) {
+    for (size_t i = 0; i < element_count; i++) {
+        list_add(list, scattered[i]);
+    }
+}
+
+static void build_list(void) {
+    list = list_create();
+    fill_list();
+}
+
+static void destroy_list(void) {
+    list_destroy(list, NULL);
+    list = NULL;
+}
+
+static void create_empty_list(void) {
+    list = list_create();
+}
+
+static void iterate_list(void) {
+    ListIterator * iter = list_iterator_create(list);
+    void * data;
+    long long sum = 0;
+    while (list_iterator_next(iter, &data)) {
+        sum += *(int *)data;
+    }
+    list_iterator_destroy(iter);
+    sink = sum;
+}
+
+static void merge_sort_list(void) {
+    list_merge_sort(list, compare_ints);
+}
+
+static uint64_t int_key(const void *data) {
+    return list_key_from_int64(*(const int *)data);
+}
+
+static void sort_list_by_key(void) {
+    list_sort_by_key(list, int_key);
+}
+
+// Every URL shares a long prefix and only differs in a number scattered elements give
+#define BENCH_URL_FORMAT "https://service.example.com/api/v2/accounts/%010d/orders"
+#define BENCH_URL_SIZE 64
+
+static void build_url_list(void) {
+    url_buffer = malloc(element_count * BENCH_URL_SIZE);
+    list = list_create();
+    for (size_t i = 0; i < element_count; i++) {
+        char * url = url_buffer + i * BENCH_URL_SIZE;
+        snprintf(url, BENCH_URL_SIZE, BENCH_URL_FORMAT, *scattered[i]);
+        list_add(list, url);
+    }
+}
+
+static void destroy_url_list(void) {
+    destroy_list();
+    free(url_buffer);
+    url_buffer = NULL;
+}
+
+static int compare_strcmp(const void *a, const void *b) {
+    return strcmp(a, b);
+}
+
+static void merge_sort_urls(void) {
+    list_merge_sort(list, compare_strcmp);
+}
+
+static void sort_urls(void) {
+    list_sort_strings(list);
+}
+
+static void fifo_list(void) {
+    void * data;
+    for (size_t i = 0; i < element_count; i++) {
+        list_add(list, scattered[i]);
+        if (list_size(list) > BENCH_FIFO_DEPTH) list_remove_at(list, 0, &data);
+    }
+}
+
+static void create_deque(void) {
+    deque = list_deque_create();
+    // get the first block allocated outside the measurement: after a big list was
+    // freed, that malloc can pay for the allocator tidying up after the list
+    void * data;
+    list_deque_push_back(deque, scattered[0]);
+    list_deque_pop_front(deque, &data);
+}
+
+static void fifo_deque(void) {
+    void * data;
+    for (size_t i = 0; i < element_count; i++) {
+        list_deque_push_back(deque, scattered[i]);
+        if (list_deque_size(deque) > BENCH_FIFO_DEPTH) list_deque_pop_front(deque, &data);
+    }
+}
+
+static void destroy_deque(void) {
+    list_deque_destroy(deque, NULL);
+    deque = NULL;
+}
+
+static void build_huge_arena_list(void) {
+    arena = list_arena_create_huge(0);
+    list = list_create_in_arena(arena);
+    fill_list();
+}
+
+static void destroy_huge_arena_list(void) {
+    ListArenaStats stats;
+    if (list_arena_stats(arena, &stats) == 0) {
+        printf("%-28s %zu of %zu bytes on huge pages\n", "  huge arena", stats.huge_page_bytes, stats.reserved_bytes);
+    }
+    list_arena_destroy(arena);
+    arena = NULL;
+    list = NULL;
+}
+
+// LRU keys are element numbers 1..element_count stored in the pointer itself,
+// numbers above that are never put and always miss
+static void *lru_key(size_t number) {
+    return (void *)(uintptr_t)number;
+}
+
+// The number of the element at scattered[i], so lookups come in a random order
+static size_t scattered_number(size_t i) {
+    return (size_t)(scattered[i] - values) + 1;
+}
+
+static size_t lru_hash(const void *key) {
+    uint64_t x = (uint64_t)(uintptr_t)key;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (size_t)x;
+}
+
+static int lru_equals(const void *a, const void *b) {
+    return a == b;
+}
+
+static void create_lru(size_t max_count) {
+    lru = list_lru_cache_create(max_count, lru_hash, lru_equals);
+}
+
+static void create_empty_lru(void) {
+    create_lru(element_count / 2 + 1);
+}
+
+static void build_full_lru(void) {
+    create_lru(element_count);
+    for (size_t i = 1; i <= element_count; i++) {
+        list_lru_cache_put(lru, lru_key(i), scattered[i - 1]);
+    }
+}
+
+static void destroy_lru(void) {
+    list_lru_cache_destroy(lru);
+    lru = NULL;
+}
+
+static void lru_get_hits(void) {
+    void * value;
+    long long hits = 0;
+    for (size_t i = 0; i < element_count; i++) {
+        hits += list_lru_cache_get(lru, lru_key(scattered_number(i)), &value) == 0;
+    }
+    sink = hits;
+}
+
+static void lru_get_misses(void) {
+    void * value;
+    long long hits = 0;
+    for (size_t i = 0; i < element_count; i++) {
+        hits += list_lru_cache_get(lru, lru_key(element_count + scattered_number(i)), &value) == 0;
+    }
+    sink = hits;
+}
+
+// The usual cache pattern: look up, and put on a miss. Keys come from a skewed
+// draw over all elements while the cache holds half of them.
+static void lru_get_or_put(void) {
+    void * value;
+    long long hits = 0;
+    for (size_t i = 0; i < element_count; i++) {
+        size_t a = scattered_number(i);
+        size_t b = scattered_number((i * 7 + 3) % element_count);
+        size_t number = a < b ? a : b;
+        if (list_lru_cache_get(lru, lru_key(number), &value) == 0) {
+            hits++;
+        } else {
+            list_lru_cache_put(lru, lru_key(number), scattered[number - 1]);
+        }
+    }
+    sink = hits;
+}
+
+static void destroy_lru_with_hit_rate(void) {
+    printf("%-28s %.1f%% hits\n", "  lru get-or-put", 100.0 * (double)sink / (double)element_count);
+    destroy_lru();
+}
+
+static const Benchmark benchmarks[] = {
+    {"list_add", create_empty_list, fill_list, destroy_list},
+    {"iterate", build_list, iterate_list, destroy_list},
+    {"list_destroy", build_list, destroy_list, NULL},
+    {"list_merge_sort", build_list, merge_sort_list, destroy_list},
+    {"list_sort_by_key", build_list, sort_list_by_key, destroy_list},
+    {"list_merge_sort (urls)", build_url_list, merge_sort_urls, destroy_url_list},
+    {"list_sort_strings (urls)", build_url_list, sort_urls, destroy_url_list},
+    {"fifo list_add/remove_at", create_empty_list, fifo_list, destroy_list},
+    {"fifo deque push/pop", create_deque, fifo_deque, destroy_deque},
+    {"iterate (huge page arena)", build_huge_arena_list, iterate_list, destroy_huge_arena_list},
+    {"lru get (all hits)", build_full_lru, lru_get_hits, destroy_lru},
+    {"lru get (all misses)", build_full_lru, lru_get_misses, destroy_lru},
+    {"lru get-or-put", create_empty_lru, lru_get_or_put, destroy_lru_with_hit_rate},
+};
+
+int main(int argc, char *argv[]) {
+    element_count = BENCH_DEFAULT_ELEMENTS;
+    if (argc > 1) element_count = (size_t)strtoull(argv[1], NULL, 10);
+    if (element_count == 0) {
+        fprintf(stderr, "usage: %s [elements]\n", argv[0]);
+        return 1;
+    }
+
+    values = malloc(element_count * sizeof(int));
+    scattered = malloc(element_count * sizeof(int *));
+    if (values == NULL || scattered == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    srand(1);
+    for (size_t i = 0; i < element_count; i++) {
+        values[i] = rand();
+        scattered[i] = &values[i];
+    }
+    for (size_t i = element_count - 1; i > 0; i--) {
+        size_t j = (size_t)rand() % (i + 1);
+        int * swap = scattered[i];
+        scattered[i] = scattered[j];
+        scattered[j] = swap;
+    }
+
+    counters_open();
+    printf("%zu elements, %d of %d hardware counters available%s\n", element_count, counters.available,
+           (int)COUNTER_COUNT, counters.available == 0 ? ", wall-clock only" : "");
+    print_header();
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        run_benchmark(&benchmarks[i]);
+    }
+    counters_close();
+
+    free(scattered);
+    free(values);
+    return 0;
+}
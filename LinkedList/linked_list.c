@@ -1,45 +1,225 @@
 #include "linked_list.h"
+#include "linked_list_internal.h"
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
-// Linked list structures
-struct LinkedListNode {
-    void * data;
-    struct LinkedListNode * next;
-};
+// Node allocation
 
-struct LinkedList {
-    size_t size;
-    struct LinkedListNode * head;
-    struct LinkedListNode * tail;
-};
+#define INLINE_ALL_USED ((1u << LIST_INLINE_NODES) - 1)
+
+// Gets a node from wherever this list keeps its nodes
+LinkedListNode *list_node_alloc(LinkedList *list) {
+    LinkedListNode * node;
+    if (list->inline_mode) {
+        if (list->inline_used != INLINE_ALL_USED) {
+            unsigned int slot = 0;
+            while (list->inline_used & (1u << slot)) slot++;
+            list->inline_used |= 1u << slot;
+            node = &list->inline_nodes[slot];
+            node->refs = 1;
+            node->handle = 0;
+            return node;
+        }
+        // outgrown, from now on the list uses ordinary nodes only
+        if (list_spill_inline(list) != 0) return NULL;
+    }
+
+    if (list->arena != NULL) {
+        node = list_arena_alloc(list->arena, sizeof(LinkedListNode));
+    } else {
+        node = list_node_cache_alloc();
+    }
+    if (node != NULL) {
+        node->refs = 1;
+        node->handle = 0;
+    }
+    return node;
+}
+
+// Gives a node back, arena nodes are only reclaimed by resetting the arena
+void list_node_release(LinkedList *list, LinkedListNode *node) {
+    list_handle_forget(list, node);
+    uintptr_t offset = (uintptr_t)node - (uintptr_t)list->inline_nodes;
+    if (offset < sizeof(list->inline_nodes)) {
+        list->inline_used &= ~(1u << (offset / sizeof(LinkedListNode)));
+        return;
+    }
+    if (list->arena != NULL) return;
+    list_node_cache_free(node);
+}
+
+// Moves every node of a list out of its header storage into ordinary nodes,
+// for operations that share nodes or hand them to another list.
+// returns 0 on success (also when there was nothing to move), -1 on failure
+int list_spill_inline(LinkedList *list) {
+    if (!list->inline_mode) return 0;
+    list->inline_mode = 0;
+
+    // get every replacement first, so a failure leaves the list as it was
+    LinkedListNode * fresh[LIST_INLINE_NODES];
+    for (size_t i = 0; i < list->size; i++) {
+        fresh[i] = list_node_alloc(list);
+        if (fresh[i] == NULL) {
+            while (i-- > 0) {
+                list_node_release(list, fresh[i]);
+            }
+            list->inline_mode = 1;
+            return -1;
+        }
+    }
+
+    LinkedListNode ** link = &list->head;
+    for (size_t i = 0; i < list->size; i++) {
+        LinkedListNode * node = *link;
+        fresh[i]->data = node->data;
+        fresh[i]->next = node->next;
+        *link = fresh[i];
+        list_index_replace(list, node, fresh[i]);
+        list_handle_replace(list, node, fresh[i]);
+        if (list->tail == node) list->tail = fresh[i];
+        list_node_release(list, node);
+        link = &fresh[i]->next;
+    }
+    list_handle_relink(list, list->size);
+    return 0;
+}
+
+// Copy-on-write snapshots
+//
+// A snapshot is a read-only list that shares the nodes of the list it was taken from.
+// Every node counts the references to it, and as long as snapshots exist the list
+// copies a node before changing its next pointer if that node is shared, so the
+// snapshot never sees the change. Appends are the exception: a snapshot only reads
+// as many nodes as it had elements, so linking a node after the shared tail is safe.
+// The chain of a snapshot can go on past its last element that way, so releasing a
+// view only applies free_func to the first size nodes, the rest belong to other views.
+
+// Drops one reference to node and frees every node that nobody refers to anymore,
+// following the chain for as long as that happens. free_func only runs on the
+// first count nodes, the ones the released list holds.
+static void chain_release(LinkedList *list, LinkedListNode *node, size_t count, void (*free_func)(void *)) {
+    while (node != NULL && --node->refs == 0) {
+        LinkedListNode * to_delete = node;
+        node = node->next;
+
+        if (count > 0) {
+            if (free_func != NULL) {
+                free_func(to_delete->data);
+            }
+            count--;
+        }
+        list_node_release(list, to_delete);
+    }
+}
+
+// Makes the first count nodes of the list private to it, copying every node
+// from the first shared one onwards. Nodes after them may stay shared.
+// returns 0 on success, -1 on failure (the list is still consistent then)
+static int unshare_prefix(LinkedList *list, size_t count) {
+    LinkedListNode ** link = &list->head;
+    int copying = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        LinkedListNode * node = *link;
+        // everything reachable from a shared node is shared as well
+        if (node->refs > 1) copying = 1;
+
+        if (copying) {
+            LinkedListNode * copy = list_node_alloc(list);
+            if (copy == NULL) return -1;
+            copy->data = node->data;
+            copy->next = node->next;
+            if (copy->next != NULL) copy->next->refs++;
+
+            // the old node lives on in whatever shares it
+            *link = copy;
+            node->refs--;
+            list_index_replace(list, node, copy);
+            list_handle_replace(list, node, copy);
+            if (list->tail == node) list->tail = copy;
+            node = copy;
+        }
+        link = &node->next;
+    }
+    if (copying) list_handle_relink(list, count);
+    return 0;
+}
+
+// Copies every node the list still shares with a snapshot, so it can be relinked freely.
+// Operations that move nodes around call this first, it costs nothing for unshared lists.
+// returns 0 on success, -1 on failure
+int list_make_private(LinkedList *list) {
+    if (list->read_only) return -1;
+    if (!list->shared) return 0;
+    if (unshare_prefix(list, list->size) != 0) return -1;
+    list->shared = 0;
+    return 0;
+}
 
 // Linked list functions
 
-// Creates and initializes an empty linked list
-LinkedList *list_create(void) {
-    // create and return an empty linked list:
-    LinkedList * list = malloc(sizeof(LinkedList));
+// Does the work of list_create and list_create_in_arena, the header comes from
+// arena when there is one
+static LinkedList *create(ListArena *arena) {
+    LinkedList * list;
+    if (arena != NULL) {
+        list = list_arena_alloc(arena, sizeof(LinkedList));
+    } else {
+        list = malloc(sizeof(LinkedList));
+    }
     if (list == NULL) {
         return NULL;
     }
     list->size = 0;
     list->head = NULL;
     list->tail = NULL;
+    list->arena = arena;
+    list->index = NULL;
+    list->handles = NULL;
+    list->read_only = 0;
+    list->shared = 0;
+    list->inline_mode = 1;
+    list->inline_used = 0;
+    list->record_id = 0;
+    return list;
+}
+
+// Creates and initializes an empty linked list.
+// The first 8 elements are kept inside the list itself, so small lists cost a
+// single allocation; a list that grows past that moves to separate nodes for good.
+LinkedList *list_create(void) {
+    // create and return an empty linked list:
+    LinkedList * list = create(NULL);
+    list_record_call(LIST_RECORD_CREATE, list, 0);
     return list;
 };
 
-// Inserts a new node at the end of the list
-// returns 0 on success. -1 on failure
-int list_add(LinkedList *list, void *data) {
-    if (list == NULL) return -1;
+// Creates an empty linked list whose header and nodes are all taken from arena
+LinkedList *list_create_in_arena(ListArena *arena) {
+    if (arena == NULL) return NULL;
+    LinkedList * list = create(arena);
+    list_record_call(LIST_RECORD_CREATE, list, 0);
+    return list;
+};
+
+// Does the work of list_add and list_add_with_handle (out_handle may be NULL)
+static int add(LinkedList *list, void *data, ListHandle *out_handle) {
+    if (list == NULL || list->read_only) return -1;
+    if (out_handle != NULL && list_handle_reserve(list) != 0) return -1;
 
-    LinkedListNode * new_node = malloc(sizeof(LinkedListNode));
+    LinkedListNode * new_node = list_node_alloc(list);
     if (new_node == NULL) return -1;
 
     new_node->data = data;
     new_node->next = NULL;
+    if (list_index_insert(list, new_node) != 0) {
+        list_node_release(list, new_node);
+        return -1;
+    }
 
+    LinkedListNode * prev = list->size > 0 ? list->tail : NULL;
     if (list->size == 0) {
         list->head = new_node;
     } else {
@@ -47,21 +227,56 @@ int list_add(LinkedList *list, void *data) {
     }
     list->tail = new_node;
     list->size++;
+
+    if (out_handle != NULL) *out_handle = list_handle_assign(list, new_node, prev);
     return 0;
+}
+
+// Inserts a new node at the end of the list
+// returns 0 on success. -1 on failure
+int list_add(LinkedList *list, void *data) {
+    list_record_call(LIST_RECORD_ADD, list, 0);
+    return add(list, data, NULL);
 };
 
-// Inserts a new node at a specific index (0-based)
-// Returns 0 if successful, -1 if index is out of bounds
-int list_insert_at(LinkedList *list, size_t index, void *data) {
-    if (list == NULL || index > list->size) return -1;
+// Does the work of list_add without logging the call, for adds the library makes on its own
+// returns 0 on success, -1 on failure
+int list_add_unrecorded(LinkedList *list, void *data) {
+    return add(list, data, NULL);
+}
 
-    LinkedListNode * new_node = malloc(sizeof(LinkedListNode));
+// Same as list_add, and stores a handle to the new element in *out_handle
+// returns 0 on success, -1 on failure
+int list_add_with_handle(LinkedList *list, void *data, ListHandle *out_handle) {
+    if (out_handle == NULL) return -1;
+    list_record_call(LIST_RECORD_ADD, list, 0);
+    return add(list, data, out_handle);
+};
+
+// Does the work of list_insert_at and list_insert_at_with_handle (out_handle may be NULL)
+static int insert_at(LinkedList *list, size_t index, void *data, ListHandle *out_handle) {
+    if (list == NULL || list->read_only || index > list->size) return -1;
+    // the node before the new one gets a new next pointer, so it must not be shared
+    if (list->shared && index > 0 && index < list->size && unshare_prefix(list, index) != 0) return -1;
+    if (out_handle != NULL && list_handle_reserve(list) != 0) return -1;
+
+    LinkedListNode * new_node = list_node_alloc(list);
     if (new_node == NULL) return -1;
     new_node->data = data;
+    if (list_index_insert(list, new_node) != 0) {
+        list_node_release(list, new_node);
+        return -1;
+    }
 
+    LinkedListNode * prev = NULL;
     if (index == 0) {
         new_node->next = list->head;
         list->head = new_node;
+    } else if (index == list->size) {
+        // appending, no need to walk there
+        new_node->next = NULL;
+        prev = list->tail;
+        list->tail->next = new_node;
     } else {
         LinkedListNode * cursor = list->head;
 
@@ -71,15 +286,42 @@ int list_insert_at(LinkedList *list, size_t index, void *data) {
 
         new_node->next = cursor->next;
         cursor->next = new_node;
+        prev = cursor;
     }
+    list_handle_set_prev(list, new_node->next, new_node);
 
+    if (new_node->next == NULL) {
+        list->tail = new_node;
+    }
     list->size++;
+
+    if (out_handle != NULL) *out_handle = list_handle_assign(list, new_node, prev);
     return 0;
+}
+
+// Inserts a new node at a specific index (0-based)
+// Returns 0 if successful, -1 if index is out of bounds
+int list_insert_at(LinkedList *list, size_t index, void *data) {
+    list_record_call(LIST_RECORD_INSERT_AT, list, index);
+    uint64_t trace_start = list_trace_begin();
+    int result = insert_at(list, index, data, NULL);
+    list_trace_end(LIST_TRACE_INSERT_AT, trace_start);
+    return result;
 };
 
-// fetches an element at specified index
+// Same as list_insert_at, and stores a handle to the new element in *out_handle
 // returns 0 on success, -1 on failure
-int list_get_at(LinkedList *list, size_t index, void **out_data) {
+int list_insert_at_with_handle(LinkedList *list, size_t index, void *data, ListHandle *out_handle) {
+    if (out_handle == NULL) return -1;
+    list_record_call(LIST_RECORD_INSERT_AT, list, index);
+    uint64_t trace_start = list_trace_begin();
+    int result = insert_at(list, index, data, out_handle);
+    list_trace_end(LIST_TRACE_INSERT_AT, trace_start);
+    return result;
+};
+
+// Does the work of list_get_at
+static int get_at(LinkedList *list, size_t index, void **out_data) {
     if (list == NULL || out_data == NULL || index >= list->size) return -1;
 
     LinkedListNode * cursor = list->head;
@@ -90,12 +332,23 @@ int list_get_at(LinkedList *list, size_t index, void **out_data) {
 
     *out_data = cursor->data;
     return 0;
+}
+
+// fetches an element at specified index
+// returns 0 on success, -1 on failure
+int list_get_at(LinkedList *list, size_t index, void **out_data) {
+    list_record_call(LIST_RECORD_GET_AT, list, index);
+    uint64_t trace_start = list_trace_begin();
+    int result = get_at(list, index, out_data);
+    list_trace_end(LIST_TRACE_GET_AT, trace_start);
+    return result;
 };
 
-// Removes and returns the element at a specific index
-// returns 0 on sucsess, -1 on failure
-int list_remove_at(LinkedList *list, size_t index, void **out_data) {
-    if (list == NULL || index >= list->size) return -1;
+// Does the work of list_remove_at
+static int remove_at(LinkedList *list, size_t index, void **out_data) {
+    if (list == NULL || list->read_only || index >= list->size) return -1;
+    // the node before the removed one gets a new next pointer, so it must not be shared
+    if (list->shared && index > 0 && unshare_prefix(list, index) != 0) return -1;
 
     LinkedListNode * cursor = list->head;
     LinkedListNode * removed_node;
@@ -106,6 +359,7 @@ int list_remove_at(LinkedList *list, size_t index, void **out_data) {
         if (list->size == 1) {
             list->tail = NULL;
         }
+        list_handle_set_prev(list, list->head, NULL);
 
     } else {
         for (size_t i = 0; i < index -1; i++) {
@@ -114,14 +368,198 @@ int list_remove_at(LinkedList *list, size_t index, void **out_data) {
         removed_node = cursor->next;
         cursor->next = removed_node->next;
 
-        if (list->size == 1) {
-            list->tail = cursor->next;
+        if (cursor->next == NULL) {
+            list->tail = cursor;
         }
+        list_handle_set_prev(list, cursor->next, cursor);
     }
 
     *out_data = removed_node->data;
     list->size--;
-    free(removed_node);
+    list_index_erase(list, removed_node);
+    if (removed_node->refs > 1) {
+        // a snapshot still sees the node, and through it the rest of the chain
+        if (removed_node->next != NULL) removed_node->next->refs++;
+        removed_node->refs--;
+        list_handle_forget(list, removed_node);
+    } else {
+        list_node_release(list, removed_node);
+    }
+    return 0;
+}
+
+// Removes and returns the element at a specific index
+// returns 0 on sucsess, -1 on failure
+int list_remove_at(LinkedList *list, size_t index, void **out_data) {
+    list_record_call(LIST_RECORD_REMOVE_AT, list, index);
+    uint64_t trace_start = list_trace_begin();
+    int result = remove_at(list, index, out_data);
+    list_trace_end(LIST_TRACE_REMOVE_AT, trace_start);
+    return result;
+};
+
+// A requested position and where the request came in the caller's arrays
+typedef struct PositionRequest {
+    size_t index;
+    size_t order;
+} PositionRequest;
+
+static int compare_requests(const void *a, const void *b) {
+    const PositionRequest * x = a;
+    const PositionRequest * y = b;
+    if (x->index != y->index) return x->index < y->index ? -1 : 1;
+    return (x->order > y->order) - (x->order < y->order);
+}
+
+// Takes the free slot that has rank free slots before it. tree is a 1-based
+// Fenwick tree of size entries counting free slots, highest_bit the largest
+// power of two not above size.
+// returns the 0-based slot
+static size_t fenwick_take(size_t *tree, size_t size, size_t highest_bit, size_t rank) {
+    // walk down to the last position whose prefix sum is at most rank
+    size_t position = 0;
+    for (size_t step = highest_bit; step > 0; step >>= 1) {
+        if (position + step <= size && tree[position + step] <= rank) {
+            position += step;
+            rank -= tree[position];
+        }
+    }
+    for (size_t i = position + 1; i <= size; i += i & (~i + 1)) {
+        tree[i]--;
+    }
+    return position;
+}
+
+// Inserts n items at once, with the same result as calling
+// list_insert_at(list, indices[i], items[i]) for i = 0 .. n-1 in turn,
+// so every index counts the items inserted before it. Unlike those calls it
+// walks the list only once, as far as the furthest insert, in O(n log n) on top.
+// Either all items are inserted or, on failure, none are.
+// returns 0 on success, -1 on failure (including an index out of bounds at its turn)
+int list_insert_many(LinkedList *list, const size_t *indices, void *const *items, size_t n) {
+    if (list == NULL || list->read_only || (n > 0 && (indices == NULL || items == NULL))) return -1;
+    if (n == 0) return 0;
+
+    // the i-th insert sees i more elements than the list has now
+    size_t highest = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (indices[i] > list->size + i) return -1;
+        if (indices[i] > highest) highest = indices[i];
+    }
+    // the nodes are taken before any is linked in, so spilling cannot wait until they run out
+    if (list->size + n > LIST_INLINE_NODES && list_spill_inline(list) != 0) return -1;
+
+    // Final slots: the last insert lands exactly at its index, every earlier one
+    // at the slot with index free slots before it once the later ones are placed.
+    // Every slot ends up below highest + n, so the tree only has to cover that much.
+    size_t slots = highest + n;
+    size_t * tree = malloc((slots + 1) * sizeof(size_t));
+    PositionRequest * placed = malloc(n * sizeof(PositionRequest));
+    LinkedListNode ** nodes = calloc(n, sizeof(LinkedListNode *));
+    int failed = tree == NULL || placed == NULL || nodes == NULL;
+    for (size_t i = 0; !failed && i < n; i++) {
+        nodes[i] = list_node_alloc(list);
+        if (nodes[i] == NULL) failed = 1;
+    }
+    if (failed || list_index_reserve(list, n) != 0) {
+        for (size_t i = 0; nodes != NULL && i < n && nodes[i] != NULL; i++) {
+            list_node_release(list, nodes[i]);
+        }
+        free(tree);
+        free(placed);
+        free(nodes);
+        return -1;
+    }
+
+    // every slot starts out free
+    size_t highest_bit = 1;
+    for (size_t i = 1; i <= slots; i++) {
+        tree[i] = i & (~i + 1);
+        while (highest_bit * 2 <= i) highest_bit *= 2;
+    }
+    for (size_t i = n; i-- > 0;) {
+        placed[i].index = fenwick_take(tree, slots, highest_bit, indices[i]);
+        placed[i].order = i;
+    }
+    free(tree);
+    qsort(placed, n, sizeof(PositionRequest), compare_requests);
+
+    // the original node in front of each inserted one gets a new next pointer,
+    // so it must not be shared; linking after the tail is safe as for list_add
+    if (list->shared) {
+        size_t touched = 0;
+        for (size_t e = 0; e < n; e++) {
+            size_t before = placed[e].index - e;
+            if (before < list->size && before > touched) touched = before;
+        }
+        if (touched > 0 && unshare_prefix(list, touched) != 0) {
+            for (size_t i = 0; i < n; i++) {
+                list_node_release(list, nodes[i]);
+            }
+            free(placed);
+            free(nodes);
+            return -1;
+        }
+    }
+
+    LinkedListNode ** link = &list->head;
+    LinkedListNode * last = NULL;
+    size_t next = 0;
+    for (size_t slot = 0; next < n; slot++) {
+        if (placed[next].index == slot) {
+            LinkedListNode * node = nodes[placed[next].order];
+            node->data = items[placed[next].order];
+            node->next = *link;
+            *link = node;
+            list_index_insert(list, node);
+            next++;
+            last = node;
+        } else {
+            last = *link;
+        }
+        link = &last->next;
+    }
+    if (last->next == NULL) {
+        list->tail = last;
+    }
+    list->size += n;
+    list_handle_relink(list, list->size);
+
+    free(placed);
+    free(nodes);
+    return 0;
+};
+
+// Fetches the elements at n indices with a single walk over the list, as far
+// as the highest index, storing the element at indices[i] in out[i].
+// Indices may come in any order and repeat.
+// returns 0 on success, -1 on failure (nothing is stored if an index is out of bounds)
+int list_get_many(LinkedList *list, const size_t *indices, void **out, size_t n) {
+    if (list == NULL || (n > 0 && (indices == NULL || out == NULL))) return -1;
+    if (n == 0) return 0;
+    for (size_t i = 0; i < n; i++) {
+        if (indices[i] >= list->size) return -1;
+    }
+
+    PositionRequest * requests = malloc(n * sizeof(PositionRequest));
+    if (requests == NULL) return -1;
+    for (size_t i = 0; i < n; i++) {
+        requests[i].index = indices[i];
+        requests[i].order = i;
+    }
+    qsort(requests, n, sizeof(PositionRequest), compare_requests);
+
+    LinkedListNode * cursor = list->head;
+    size_t position = 0;
+    for (size_t i = 0; i < n; i++) {
+        while (position < requests[i].index) {
+            cursor = cursor->next;
+            position++;
+        }
+        out[requests[i].order] = cursor->data;
+    }
+
+    free(requests);
     return 0;
 };
 
@@ -135,7 +573,32 @@ size_t list_size(const LinkedList *list) {
 // if NULL is passed in for the function pointer it does not free any data
 // and only frees the list itself.
 void list_destroy(LinkedList *list, void (*free_func)(void *)) {
+    list_record_call(LIST_RECORD_DESTROY, list, 0);
+    list_destroy_unrecorded(list, free_func);
+};
+
+// Does the work of list_destroy without logging the call, for lists the library
+// destroys on its own or on behalf of a call that was logged already
+void list_destroy_unrecorded(LinkedList *list, void (*free_func)(void *)) {
     if (list == NULL) return;
+    list_index_free(list);
+    list_handle_free(list);
+
+    // nodes shared with snapshots stay around for them, only the rest is freed
+    if (list->shared || list->read_only) {
+        chain_release(list, list->head, list->size, free_func);
+        if (list->arena == NULL) free(list);
+        return;
+    }
+
+    // arena lists own no memory of their own, only the data may need freeing
+    if (list->arena != NULL) {
+        if (free_func == NULL) return;
+        for (LinkedListNode * cursor = list->head; cursor != NULL; cursor = cursor->next) {
+            free_func(cursor->data);
+        }
+        return;
+    }
 
     if (list->size == 0) {
         free(list);
@@ -146,7 +609,7 @@ void list_destroy(LinkedList *list, void (*free_func)(void *)) {
         if (free_func != NULL) {
             free_func(list->head->data);
         }
-        free(list->head);
+        list_node_release(list, list->head);
         free(list);
         return;
     }
@@ -159,10 +622,41 @@ void list_destroy(LinkedList *list, void (*free_func)(void *)) {
         if (free_func != NULL) {
             free_func(to_delete->data);
         }
-        free(to_delete);
+        list_node_release(list, to_delete);
     }
     free(list);
-};
+}
+
+// Destroys a list at most max_nodes nodes at a time, freeing them the way
+// list_destroy would, so long lists can be torn down in bounded steps
+// returns 1 once the list is completely gone, 0 if it has to be called again
+int list_destroy_batch(LinkedList *list, void (*free_func)(void *), size_t max_nodes) {
+    list_index_free(list);
+    list_handle_free(list);
+
+    for (size_t i = 0; i < max_nodes && list->head != NULL; i++) {
+        LinkedListNode * node = list->head;
+        // a node some snapshot still sees keeps itself and the rest of the chain alive
+        if (--node->refs > 0) {
+            list->head = NULL;
+            break;
+        }
+        list->head = node->next;
+
+        // size counts down the elements left, nodes past them belong to other views
+        if (list->size > 0) {
+            if (free_func != NULL) {
+                free_func(node->data);
+            }
+            list->size--;
+        }
+        list_node_release(list, node);
+    }
+    if (list->head != NULL) return 0;
+
+    if (list->arena == NULL) free(list);
+    return 1;
+}
 
 // Linked list iterator functions
 
@@ -170,49 +664,173 @@ void list_destroy(LinkedList *list, void (*free_func)(void *)) {
 // helps us move from one item to the next item
 // efficiently, but without exposing the internal components of the
 // linked list itself.
+typedef struct SortedEntry SortedEntry;
+
 typedef struct ListIterator {
     LinkedListNode * cursor;
     LinkedList * list;
+    // elements left to hand out, snapshots end before their chain does
+    size_t remaining;
+    // only used by sorted iterators: a min-heap of the elements not handed out yet
+    int (*compare)(const void *, const void *);
+    SortedEntry * heap;
+    size_t heap_count;
+    size_t heap_capacity;
+    // number of the iterator in the trace being recorded, 0 until it shows up there
+    uint64_t record_id;
 } ListIterator;
 
-// Creates an iterator for the given list starting at the first element
-ListIterator *list_iterator_create(LinkedList *list) {
+// Does the work of list_iterator_create
+static ListIterator *iterator_create(LinkedList *list) {
     if (list == NULL) return NULL;
     ListIterator * iter = malloc(sizeof(ListIterator));
     if (iter == NULL) return NULL;
 
     iter->cursor = list->head;
     iter->list = list;
+    iter->remaining = list->size;
+    iter->compare = NULL;
+    iter->heap = NULL;
+    iter->heap_count = 0;
+    iter->heap_capacity = 0;
+    iter->record_id = 0;
+    return iter;
+}
+
+// Creates an iterator for the given list starting at the first element
+ListIterator *list_iterator_create(LinkedList *list) {
+    ListIterator * iter = iterator_create(list);
+    if (iter != NULL) list_record_iterator_call(LIST_RECORD_ITERATOR_CREATE, list, &iter->record_id);
     return iter;
 };
 
+static int sorted_iterator_next(ListIterator *iter, void **out_data);
+static int sorted_iterator_fill(ListIterator *iter);
+
 // Advances the iterator and retrieves the next element
 // Returns 1 if there is a next element, 0 if the end of the list is reached
 int list_iterator_next(ListIterator *iter, void **out_data) {
-    if (iter == NULL) return -1;
+    if (iter == NULL || out_data == NULL) return -1;
+    if (iter->compare != NULL) return sorted_iterator_next(iter, out_data);
+    list_record_iterator_call(LIST_RECORD_ITERATOR_NEXT, iter->list, &iter->record_id);
+
+    if (iter->remaining == 0) return 0;
+    *out_data = iter->cursor->data;
     iter->cursor = iter->cursor->next;
-    if (iter->cursor->next == NULL) {
-        *out_data = iter->cursor->data;
-        return 0;
-    } else {
-        *out_data = iter->cursor->data;
-        return 1;
-    }
+    iter->remaining--;
+    return 1;
 };
 
 // Resets the iterator to the start of the list
 void list_iterator_reset(ListIterator *iter) {
     if (iter == NULL) return;
+    if (iter->compare != NULL) {
+        sorted_iterator_fill(iter);
+        return;
+    }
+    list_record_iterator_call(LIST_RECORD_ITERATOR_RESET, iter->list, &iter->record_id);
     iter->cursor = iter->list->head;
+    iter->remaining = iter->list->size;
 };
 
 // Destroys the iterator and frees any allocated memory
 // notice this has nothing to do with the list that this iterator is pointing to
 void list_iterator_destroy(ListIterator *iter) {
     if (iter == NULL) return;
+    // the list may be gone already, so the call is recorded without it
+    if (iter->compare == NULL) list_record_iterator_call(LIST_RECORD_ITERATOR_DESTROY, NULL, &iter->record_id);
+    free(iter->heap);
     free(iter);
 };
 
+// Sorted iterator
+//
+// Instead of sorting up front, the elements are heapified in O(n) and every
+// call to list_iterator_next pops the next smallest in O(log n). Reading the
+// first m elements costs O(n + m log n) and the list is never reordered.
+
+// An element waiting in a sorted iterator, index is its position in the list
+// and breaks ties so equal elements come out in list order
+struct SortedEntry {
+    void * data;
+    size_t index;
+};
+
+// Returns nonzero if a has to come out of the sorted iterator before b
+static int sorted_entry_less(const SortedEntry *a, const SortedEntry *b,
+                             int (*compare)(const void *, const void *)) {
+    int result = compare(a->data, b->data);
+    if (result != 0) return result < 0;
+    return a->index < b->index;
+}
+
+static void sorted_heap_sift_down(SortedEntry *heap, size_t count, size_t index,
+                                  int (*compare)(const void *, const void *)) {
+    SortedEntry entry = heap[index];
+    for (;;) {
+        size_t child = 2 * index + 1;
+        if (child >= count) break;
+        if (child + 1 < count && sorted_entry_less(&heap[child + 1], &heap[child], compare)) {
+            child++;
+        }
+        if (!sorted_entry_less(&heap[child], &entry, compare)) break;
+        heap[index] = heap[child];
+        index = child;
+    }
+    heap[index] = entry;
+}
+
+// (Re)loads the heap with the current contents of the list and heapifies it in O(n)
+// returns 0 on success, -1 if the heap could not grow, leaving the iterator empty
+static int sorted_iterator_fill(ListIterator *iter) {
+    iter->heap_count = 0;
+    if (iter->list->size > iter->heap_capacity) {
+        SortedEntry * heap = realloc(iter->heap, iter->list->size * sizeof(SortedEntry));
+        if (heap == NULL) return -1;
+        iter->heap = heap;
+        iter->heap_capacity = iter->list->size;
+    }
+
+    LinkedListNode * cursor = iter->list->head;
+    for (size_t i = 0; i < iter->list->size; i++, cursor = cursor->next) {
+        iter->heap[iter->heap_count].data = cursor->data;
+        iter->heap[iter->heap_count].index = iter->heap_count;
+        iter->heap_count++;
+    }
+    for (size_t i = iter->heap_count / 2; i-- > 0;) {
+        sorted_heap_sift_down(iter->heap, iter->heap_count, i, iter->compare);
+    }
+    return 0;
+}
+
+static int sorted_iterator_next(ListIterator *iter, void **out_data) {
+    if (iter->heap_count == 0) return 0;
+    *out_data = iter->heap[0].data;
+    iter->heap[0] = iter->heap[--iter->heap_count];
+    if (iter->heap_count > 0) {
+        sorted_heap_sift_down(iter->heap, iter->heap_count, 0, iter->compare);
+    }
+    return 1;
+}
+
+// Creates an iterator that hands out the elements of the list in sorted order
+// without sorting the list. The order is stable. The elements are captured when
+// the iterator is created or reset, later changes to the list are not seen.
+// Use it with list_iterator_next, list_iterator_reset and list_iterator_destroy.
+ListIterator *list_sorted_iterator_create(LinkedList *list, int (*compare)(const void *, const void *)) {
+    if (list == NULL || compare == NULL) return NULL;
+    ListIterator * iter = iterator_create(list);
+    if (iter == NULL) return NULL;
+
+    iter->compare = compare;
+    iter->cursor = NULL;
+    if (sorted_iterator_fill(iter) != 0) {
+        list_iterator_destroy(iter);
+        return NULL;
+    }
+    return iter;
+};
+
 // Compares two ints returning 1 if a is greater, -1 if b is greater and 0 if neither of those are true
 // casts void pointers to ints so it can be compared and returns the results
 int compare_ints(const void *a, const void *b) {
@@ -253,28 +871,45 @@ int compare_floats(const void *a, const void *b) {
 
 
 
+// Merges two sorted chains, taking from left on ties so the merge is stable.
+// Works with a moving "last" pointer instead of recursion so long chains
+// cannot run out of stack. The last node of the result is stored in *out_tail.
+static LinkedListNode *merge_chains(LinkedListNode *left, LinkedListNode *right,
+                                    int (*compare)(const void *, const void *), LinkedListNode **out_tail) {
+    LinkedListNode head;
+    LinkedListNode *last = &head;
+
+    while (left != NULL && right != NULL) {
+        if (compare(left->data, right->data) <= 0) {
+            last->next = left;
+            left = left->next;
+        } else {
+            last->next = right;
+            right = right->next;
+        }
+        last = last->next;
+    }
+
+    // whatever is left over is already sorted, hook it on and walk to its end
+    last->next = left != NULL ? left : right;
+    if (out_tail != NULL) {
+        while (last->next != NULL) {
+            last = last->next;
+        }
+        *out_tail = last;
+    }
+    return head.next;
+}
+
 // Merge two linked lists into one sorted list
 // Takes two list nodes left and right that represent sorted lists
-// Recursively merge the nodes together in order
+// Merges the nodes together in order, on ties the node from left comes first
 // Function uses comparison function compare to determine the sorting type and returns the proper sorting order
 // Returns the head of the sorted list
 LinkedListNode *merge_sorted_lists(LinkedListNode *left, LinkedListNode *right, int (*compare)(const void *, const void *)) {
     if (left == NULL) return right;
     if (right == NULL) return left;
-
-    LinkedListNode *result = NULL;
-
-    // Compare the data of both nodes and choose the smaller one as the head
-    // After recursively merge the remaining nodes of left with right
-    if (compare(left->data, right->data) <= 0) {
-        result = left;
-        result->next = merge_sorted_lists(left->next, right, compare);
-    } else {
-        result = right;
-        result->next = merge_sorted_lists(left, right->next, compare);
-    }
-
-    return result;
+    return merge_chains(left, right, compare, NULL);
 };
 
 // Splits a linked list into two halves.
@@ -336,9 +971,9 @@ LinkedListNode *merge_sort_nodes(LinkedListNode *head, int (*compare)(const void
     return merge_sorted_lists(left, right, compare);
 };
 
-// Sorts a linked list using the merge sort
-void list_merge_sort(LinkedList *list, int (*compare)(const void *, const void *)) {
-    if (list == NULL || list->head == NULL || list->size < 2) {
+// Does the work of list_merge_sort
+static void merge_sort(LinkedList *list, int (*compare)(const void *, const void *)) {
+    if (list == NULL || list->head == NULL || list->size < 2 || list_make_private(list) != 0) {
         return;
     }
 
@@ -349,4 +984,870 @@ void list_merge_sort(LinkedList *list, int (*compare)(const void *, const void *
         current = current->next;
     }
     list->tail = current;
-};
\ No newline at end of file
+    list_handle_relink(list, list->size);
+}
+
+// Sorts a linked list using the merge sort
+void list_merge_sort(LinkedList *list, int (*compare)(const void *, const void *)) {
+    list_record_call(LIST_RECORD_MERGE_SORT, list, 0);
+    uint64_t trace_start = list_trace_begin();
+    merge_sort(list, compare);
+    list_trace_end(LIST_TRACE_MERGE_SORT, trace_start);
+};
+
+// Does the work of list_merge_sort without logging or timing the call, for sorts
+// the library runs as part of another operation
+void list_merge_sort_unrecorded(LinkedList *list, int (*compare)(const void *, const void *)) {
+    merge_sort(list, compare);
+}
+
+// Merges the sorted list src into the sorted list dst in linear time.
+// The merge is stable, on ties elements already in dst come first.
+// src is left empty but still has to be destroyed by the caller.
+// Both lists have to take their nodes from the same place (malloc or the same arena).
+// returns 0 on success, -1 on failure
+int list_merge(LinkedList *dst, LinkedList *src, int (*compare)(const void *, const void *)) {
+    if (dst == NULL || src == NULL || compare == NULL || dst->arena != src->arena) return -1;
+    if (list_make_private(dst) != 0 || list_make_private(src) != 0) return -1;
+    if (dst == src || src->size == 0) return 0;
+    // Everything that can fail comes first, so a failure leaves both lists as they
+    // were: the nodes of src move to dst, and so do their index entries, and nodes
+    // kept in a header cannot move to another list. Spilling keeps the elements,
+    // handles and index of a list as they are.
+    if (list_index_reserve(dst, src->size) != 0) return -1;
+    if (list_spill_inline(dst) != 0 || list_spill_inline(src) != 0) return -1;
+    // handles belong to a list, the ones to nodes of src do not follow them
+    list_handle_clear(src);
+
+    if (dst->index != NULL) {
+        for (LinkedListNode * cursor = src->head; cursor != NULL; cursor = cursor->next) {
+            list_index_insert(dst, cursor);
+        }
+    }
+
+    if (dst->size == 0) {
+        dst->head = src->head;
+        dst->tail = src->tail;
+    } else if (compare(dst->tail->data, src->head->data) <= 0) {
+        // src starts after dst ends, so it just gets appended
+        dst->tail->next = src->head;
+        dst->tail = src->tail;
+    } else {
+        dst->head = merge_chains(dst->head, src->head, compare, &dst->tail);
+    }
+
+    dst->size += src->size;
+    src->head = NULL;
+    src->tail = NULL;
+    src->size = 0;
+    list_index_rebuild(src);
+    list_handle_relink(dst, dst->size);
+    return 0;
+};
+
+// One entry of the k-way merge heap: the next node of a list and which list it came from
+typedef struct MergeHeapEntry {
+    LinkedListNode * node;
+    size_t source;
+} MergeHeapEntry;
+
+// Heap order for the k-way merge, ties go to the lower list index to keep the merge stable
+static int merge_entry_less(const MergeHeapEntry *a, const MergeHeapEntry *b,
+                            int (*compare)(const void *, const void *)) {
+    int result = compare(a->node->data, b->node->data);
+    if (result != 0) return result < 0;
+    return a->source < b->source;
+}
+
+// Moves the entry at index down until the heap property holds again
+static void merge_heap_sift_down(MergeHeapEntry *heap, size_t count, size_t index,
+                                 int (*compare)(const void *, const void *)) {
+    MergeHeapEntry entry = heap[index];
+    for (;;) {
+        size_t child = 2 * index + 1;
+        if (child >= count) break;
+        if (child + 1 < count && merge_entry_less(&heap[child + 1], &heap[child], compare)) {
+            child++;
+        }
+        if (!merge_entry_less(&heap[child], &entry, compare)) break;
+        heap[index] = heap[child];
+        index = child;
+    }
+    heap[index] = entry;
+}
+
+// Merges k sorted lists into lists[0] in O(n log k) using a binary heap of list heads.
+// The merge is stable, on ties elements from the list with the lower index come first.
+// Every other list is left empty but still has to be destroyed by the caller.
+// All lists have to take their nodes from the same place (malloc or the same arena).
+// returns 0 on success, -1 on failure
+int list_merge_k(LinkedList **lists, size_t k, int (*compare)(const void *, const void *)) {
+    if (lists == NULL || k == 0 || compare == NULL) return -1;
+    for (size_t i = 0; i < k; i++) {
+        if (lists[i] == NULL || lists[i]->arena != lists[0]->arena) return -1;
+        if (list_make_private(lists[i]) != 0) return -1;
+    }
+    if (k == 1) return 0;
+    if (k == 2) return list_merge(lists[0], lists[1], compare);
+
+    // Everything that can fail comes first, so a failure leaves the lists as they
+    // were: the heap, room in the index of lists[0] for every node that joins it,
+    // and spilling the nodes kept in headers, which cannot move to another list.
+    // Spilling keeps the elements, handles and index of a list as they are.
+    MergeHeapEntry * heap = malloc(k * sizeof(MergeHeapEntry));
+    if (heap == NULL) return -1;
+    size_t joining = 0;
+    for (size_t i = 1; i < k; i++) {
+        if (lists[i] != lists[0]) joining += lists[i]->size;
+    }
+    if (list_index_reserve(lists[0], joining) != 0) {
+        free(heap);
+        return -1;
+    }
+    for (size_t i = 0; i < k; i++) {
+        if (list_spill_inline(lists[i]) != 0) {
+            free(heap);
+            return -1;
+        }
+    }
+    // handles belong to a list, the ones to nodes joining lists[0] do not follow them
+    for (size_t i = 1; i < k; i++) {
+        if (lists[i] != lists[0]) list_handle_clear(lists[i]);
+    }
+
+    size_t count = 0;
+    size_t total = 0;
+    for (size_t i = 0; i < k; i++) {
+        if (lists[i]->head != NULL) {
+            heap[count].node = lists[i]->head;
+            heap[count].source = i;
+            count++;
+            total += lists[i]->size;
+            // a list passed twice would get its nodes linked in twice, detach it right away
+            lists[i]->head = NULL;
+        }
+    }
+    for (size_t i = count / 2; i-- > 0;) {
+        merge_heap_sift_down(heap, count, i, compare);
+    }
+
+    // keep taking the smallest head, then put that list's next node back in its place
+    LinkedListNode head;
+    LinkedListNode *last = &head;
+    while (count > 0) {
+        LinkedListNode * smallest = heap[0].node;
+        last->next = smallest;
+        last = smallest;
+
+        if (smallest->next != NULL) {
+            heap[0].node = smallest->next;
+        } else {
+            heap[0] = heap[--count];
+        }
+        if (count > 0) {
+            merge_heap_sift_down(heap, count, 0, compare);
+        }
+    }
+    last->next = NULL;
+    free(heap);
+
+    for (size_t i = 1; i < k; i++) {
+        lists[i]->head = NULL;
+        lists[i]->tail = NULL;
+        lists[i]->size = 0;
+        list_index_rebuild(lists[i]);
+    }
+    lists[0]->head = head.next;
+    lists[0]->tail = total > 0 ? last : NULL;
+    lists[0]->size = total;
+    list_index_rebuild(lists[0]);
+    list_handle_relink(lists[0], total);
+    return 0;
+};
+
+// One candidate of the partial sort heap, index is its position in the list
+// and breaks ties so that equal elements keep their order
+typedef struct SelectEntry {
+    LinkedListNode * node;
+    size_t index;
+} SelectEntry;
+
+// Ordering of candidates, returns nonzero if a comes before b
+static int select_entry_less(const SelectEntry *a, const SelectEntry *b,
+                             int (*compare)(const void *, const void *)) {
+    int result = compare(a->node->data, b->node->data);
+    if (result != 0) return result < 0;
+    return a->index < b->index;
+}
+
+// Sift down for a max-heap of candidates, so the worst of the k kept sits on top
+static void select_heap_sift_down(SelectEntry *heap, size_t count, size_t index,
+                                  int (*compare)(const void *, const void *)) {
+    SelectEntry entry = heap[index];
+    for (;;) {
+        size_t child = 2 * index + 1;
+        if (child >= count) break;
+        if (child + 1 < count && select_entry_less(&heap[child], &heap[child + 1], compare)) {
+            child++;
+        }
+        if (!select_entry_less(&entry, &heap[child], compare)) break;
+        heap[index] = heap[child];
+        index = child;
+    }
+    heap[index] = entry;
+}
+
+static int compare_indices(const void *a, const void *b) {
+    size_t index_a = *(const size_t *)a;
+    size_t index_b = *(const size_t *)b;
+    return (index_a > index_b) - (index_a < index_b);
+}
+
+// Moves the k smallest elements, sorted, to the front of the list in O(n log k).
+// The remaining elements follow in their original order. Equal elements keep
+// their relative order. A k of at least the list size sorts the whole list.
+// returns 0 on success, -1 on failure
+int list_partial_sort(LinkedList *list, size_t k, int (*compare)(const void *, const void *)) {
+    if (list == NULL || compare == NULL || list_make_private(list) != 0) return -1;
+    if (k == 0 || list->size < 2) return 0;
+    if (k >= list->size) {
+        merge_sort(list, compare);
+        return 0;
+    }
+
+    SelectEntry * heap = malloc(k * sizeof(SelectEntry));
+    size_t * chosen = malloc(k * sizeof(size_t));
+    if (heap == NULL || chosen == NULL) {
+        free(heap);
+        free(chosen);
+        return -1;
+    }
+
+    // one pass keeping the k smallest seen so far, the largest of them on top
+    size_t count = 0;
+    size_t index = 0;
+    for (LinkedListNode * cursor = list->head; cursor != NULL; cursor = cursor->next, index++) {
+        SelectEntry entry = {cursor, index};
+        if (count < k) {
+            heap[count++] = entry;
+            if (count == k) {
+                for (size_t i = k / 2; i-- > 0;) {
+                    select_heap_sift_down(heap, k, i, compare);
+                }
+            }
+        } else if (select_entry_less(&entry, &heap[0], compare)) {
+            heap[0] = entry;
+            select_heap_sift_down(heap, k, 0, compare);
+        }
+    }
+
+    // heap sort what is left in place, popping the largest to the back
+    for (size_t end = k - 1; end > 0; end--) {
+        SelectEntry largest = heap[0];
+        heap[0] = heap[end];
+        heap[end] = largest;
+        select_heap_sift_down(heap, end, 0, compare);
+    }
+
+    // unlink the chosen nodes from the chain, what stays is the rest in original order
+    for (size_t i = 0; i < k; i++) {
+        chosen[i] = heap[i].index;
+    }
+    qsort(chosen, k, sizeof(size_t), compare_indices);
+
+    LinkedListNode rest;
+    LinkedListNode *rest_last = &rest;
+    size_t next_chosen = 0;
+    index = 0;
+    for (LinkedListNode * cursor = list->head; cursor != NULL; cursor = cursor->next, index++) {
+        if (next_chosen < k && chosen[next_chosen] == index) {
+            next_chosen++;
+        } else {
+            rest_last->next = cursor;
+            rest_last = cursor;
+        }
+    }
+    rest_last->next = NULL;
+
+    // chosen nodes in sorted order, then the rest
+    for (size_t i = 0; i + 1 < k; i++) {
+        heap[i].node->next = heap[i + 1].node;
+    }
+    heap[k - 1].node->next = rest.next;
+    list->head = heap[0].node;
+    list->tail = rest_last;
+    list_handle_relink(list, list->size);
+
+    free(heap);
+    free(chosen);
+    return 0;
+};
+
+// Three way partition of data[low..high] around a median of three pivot, so
+// lists full of equal elements do not degrade to quadratic time.
+// On return data[*out_equal_low..*out_equal_high] holds the elements equal to the pivot.
+static void select_partition(void **data, size_t low, size_t high, int (*compare)(const void *, const void *),
+                             size_t *out_equal_low, size_t *out_equal_high) {
+    size_t mid = low + (high - low) / 2;
+    void * swap;
+
+    // order low, mid and high so the median ends up in mid
+    if (compare(data[mid], data[low]) < 0) { swap = data[mid]; data[mid] = data[low]; data[low] = swap; }
+    if (compare(data[high], data[low]) < 0) { swap = data[high]; data[high] = data[low]; data[low] = swap; }
+    if (compare(data[high], data[mid]) < 0) { swap = data[high]; data[high] = data[mid]; data[mid] = swap; }
+    void * pivot = data[mid];
+
+    // [low, less) is smaller than the pivot, [less, i) equal, (greater, high] larger
+    size_t less = low;
+    size_t i = low;
+    size_t greater = high;
+    while (i <= greater) {
+        int result = compare(data[i], pivot);
+        if (result < 0) {
+            swap = data[i]; data[i] = data[less]; data[less] = swap;
+            less++;
+            i++;
+        } else if (result > 0) {
+            swap = data[i]; data[i] = data[greater]; data[greater] = swap;
+            // the pivot itself is never larger, so greater cannot run below low
+            greater--;
+        } else {
+            i++;
+        }
+    }
+    *out_equal_low = less;
+    *out_equal_high = greater;
+}
+
+// Finds the element that would be at index n if the list were sorted,
+// without sorting it. Runs quickselect over an array of the elements,
+// expected O(n). The list itself is left untouched.
+// returns 0 on success, -1 on failure
+int list_nth_element(LinkedList *list, size_t n, int (*compare)(const void *, const void *), void **out_data) {
+    if (list == NULL || compare == NULL || out_data == NULL || n >= list->size) return -1;
+
+    void ** data = malloc(list->size * sizeof(void *));
+    if (data == NULL) return -1;
+    size_t count = list->size;
+    LinkedListNode * cursor = list->head;
+    for (size_t i = 0; i < count; i++, cursor = cursor->next) {
+        data[i] = cursor->data;
+    }
+
+    size_t low = 0;
+    size_t high = count - 1;
+    while (low < high) {
+        size_t equal_low;
+        size_t equal_high;
+        select_partition(data, low, high, compare, &equal_low, &equal_high);
+        if (n < equal_low) {
+            high = equal_low - 1;
+        } else if (n > equal_high) {
+            low = equal_high + 1;
+        } else {
+            break;
+        }
+    }
+
+    *out_data = data[n];
+    free(data);
+    return 0;
+};
+
+// Key and node pair sorted by list_sort_by_key
+typedef struct KeyedNode {
+    uint64_t key;
+    LinkedListNode * node;
+} KeyedNode;
+
+// Below this many elements an insertion sort beats setting up the radix passes
+#define KEY_SORT_INSERTION_MAX 32
+
+// Stable insertion sort of pairs by key
+static void key_insertion_sort(KeyedNode *pairs, size_t count) {
+    for (size_t i = 1; i < count; i++) {
+        KeyedNode pair = pairs[i];
+        size_t j = i;
+        while (j > 0 && pairs[j - 1].key > pair.key) {
+            pairs[j] = pairs[j - 1];
+            j--;
+        }
+        pairs[j] = pair;
+    }
+}
+
+// Stable LSD radix sort of pairs by key, one byte per pass. Passes where every
+// key has the same byte are skipped, so narrow keys only pay for the bytes they use.
+// returns the array holding the result, either pairs or scratch
+static KeyedNode *key_radix_sort(KeyedNode *pairs, KeyedNode *scratch, size_t count) {
+    size_t (*counts)[256] = calloc(8, sizeof(*counts));
+    if (counts == NULL) return NULL;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t key = pairs[i].key;
+        for (int pass = 0; pass < 8; pass++) {
+            counts[pass][(key >> (pass * 8)) & 0xff]++;
+        }
+    }
+
+    KeyedNode * from = pairs;
+    KeyedNode * to = scratch;
+    for (int pass = 0; pass < 8; pass++) {
+        int shift = pass * 8;
+        if (counts[pass][(from[0].key >> shift) & 0xff] == count) continue;
+
+        size_t offset = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            size_t digit_count = counts[pass][digit];
+            counts[pass][digit] = offset;
+            offset += digit_count;
+        }
+        for (size_t i = 0; i < count; i++) {
+            to[counts[pass][(from[i].key >> shift) & 0xff]++] = from[i];
+        }
+        KeyedNode * swap = from;
+        from = to;
+        to = swap;
+    }
+    free(counts);
+    return from;
+}
+
+// Sorts the list by the unsigned 64-bit key key_fn extracts from every element.
+// key_fn is called once per element, the sort itself only looks at the keys, so
+// it never touches the data again. The sort is stable and runs in O(n) passes
+// over a contiguous array of (key, node) pairs, then relinks the nodes.
+// Use list_key_from_int64 or list_key_from_double to build keys from signed or
+// floating point fields so they sort in numeric order.
+// returns 0 on success, -1 on failure
+int list_sort_by_key(LinkedList *list, uint64_t (*key_fn)(const void *data)) {
+    if (list == NULL || key_fn == NULL || list_make_private(list) != 0) return -1;
+    if (list->size < 2) return 0;
+
+    size_t count = list->size;
+    KeyedNode * pairs = malloc(count * sizeof(KeyedNode));
+    if (pairs == NULL) return -1;
+    LinkedListNode * cursor = list->head;
+    for (size_t i = 0; i < count; i++, cursor = cursor->next) {
+        pairs[i].key = key_fn(cursor->data);
+        pairs[i].node = cursor;
+    }
+
+    KeyedNode * sorted = pairs;
+    KeyedNode * scratch = NULL;
+    if (count <= KEY_SORT_INSERTION_MAX) {
+        key_insertion_sort(pairs, count);
+    } else {
+        scratch = malloc(count * sizeof(KeyedNode));
+        sorted = scratch != NULL ? key_radix_sort(pairs, scratch, count) : NULL;
+        if (sorted == NULL) {
+            free(pairs);
+            free(scratch);
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i + 1 < count; i++) {
+        sorted[i].node->next = sorted[i + 1].node;
+    }
+    sorted[count - 1].node->next = NULL;
+    list->head = sorted[0].node;
+    list->tail = sorted[count - 1].node;
+    list_handle_relink(list, count);
+
+    free(pairs);
+    free(scratch);
+    return 0;
+};
+
+// Turns a signed integer into a key that sorts in numeric order
+uint64_t list_key_from_int64(int64_t value) {
+    return (uint64_t)value ^ ((uint64_t)1 << 63);
+};
+
+// Turns a double into a key that sorts in numeric order, negative zero before
+// zero. NaNs sort after infinity, or before negative infinity when their sign bit is set.
+uint64_t list_key_from_double(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    // negative numbers sort backwards as raw bits, so flip all of them,
+    // positive ones only need to move above the negatives
+    return (bits & ((uint64_t)1 << 63)) ? ~bits : bits | ((uint64_t)1 << 63);
+};
+
+// String sort
+//
+// A multikey quicksort: the strings are partitioned three ways on 8 bytes at a
+// time, and only the ones equal to the pivot so far move on to the next 8 bytes,
+// so a shared prefix is read once per string instead of once per comparison.
+// The 8 bytes a string is being sorted on sit next to its node as a big-endian
+// number, which orders the same as the bytes do under strcmp and keeps the
+// partitioning inside one contiguous array.
+
+// A string being sorted. prefix holds its 8 bytes from the current depth on,
+// zero filled past its end, so a prefix whose last byte is 0 ends the string.
+typedef struct StringKey {
+    uint64_t prefix;
+    const unsigned char * string;
+    LinkedListNode * node;
+    // position in the list, breaks ties between equal strings to keep the sort stable
+    size_t index;
+} StringKey;
+
+// Below this many strings an insertion sort beats partitioning further
+#define STRING_SORT_INSERTION_MAX 16
+
+// The 8 bytes of string from depth on, which must not be past its end
+static uint64_t string_prefix(const unsigned char *string, size_t depth) {
+    uint64_t prefix = 0;
+    size_t i = 0;
+    for (; i < 8 && string[depth + i] != 0; i++) {
+        prefix = prefix << 8 | string[depth + i];
+    }
+    return i == 0 ? 0 : prefix << (8 * (8 - i));
+}
+
+// Compares two strings equal in their first depth bytes, and their positions when they are equal
+static int string_key_compare(const StringKey *a, const StringKey *b, size_t depth) {
+    if (a->prefix != b->prefix) return a->prefix < b->prefix ? -1 : 1;
+    if ((a->prefix & 0xff) != 0) {
+        int result = strcmp((const char *)a->string + depth + 8, (const char *)b->string + depth + 8);
+        if (result != 0) return result;
+    }
+    return a->index < b->index ? -1 : a->index > b->index;
+}
+
+static void string_insertion_sort(StringKey *keys, size_t count, size_t depth) {
+    for (size_t i = 1; i < count; i++) {
+        StringKey key = keys[i];
+        size_t j = i;
+        while (j > 0 && string_key_compare(&keys[j - 1], &key, depth) > 0) {
+            keys[j] = keys[j - 1];
+            j--;
+        }
+        keys[j] = key;
+    }
+}
+
+static int compare_string_key_index(const void *a, const void *b) {
+    size_t index_a = ((const StringKey *)a)->index;
+    size_t index_b = ((const StringKey *)b)->index;
+    return index_a < index_b ? -1 : index_a > index_b;
+}
+
+// Number of bytes from depth on that every string shares
+static size_t common_prefix(const StringKey *keys, size_t count, size_t depth) {
+    const unsigned char * first = keys[0].string + depth;
+    size_t common = strlen((const char *)first);
+    for (size_t i = 1; i < count && common > 0; i++) {
+        const unsigned char * other = keys[i].string + depth;
+        size_t length = 0;
+        while (length < common && other[length] == first[length]) {
+            length++;
+        }
+        common = length;
+    }
+    return common;
+}
+
+static uint64_t median_of_three(uint64_t a, uint64_t b, uint64_t c) {
+    return a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+}
+
+// Median of three medians of three, spread over the whole range. The partition
+// below leaves runs reversed, which a plain median of three falls for.
+static uint64_t string_pivot(const StringKey *keys, size_t count) {
+    size_t step = count / 9;
+    uint64_t medians[3];
+    for (size_t i = 0; i < 3; i++) {
+        size_t base = i * 3 * step;
+        medians[i] = median_of_three(keys[base].prefix, keys[base + step].prefix, keys[base + 2 * step].prefix);
+    }
+    return median_of_three(medians[0], medians[1], medians[2]);
+}
+
+static void swap_string_keys(StringKey *keys, size_t i, size_t j) {
+    StringKey swap = keys[i];
+    keys[i] = keys[j];
+    keys[j] = swap;
+}
+
+// Sorts strings whose first depth bytes are all equal, with their prefixes loaded for depth
+static void string_sort(StringKey *keys, size_t count, size_t depth) {
+    while (count > STRING_SORT_INSERTION_MAX) {
+        uint64_t pivot = string_pivot(keys, count);
+
+        // three-way partition: [0, less) below, [less, greater) equal, [greater, count) above
+        size_t less = 0;
+        size_t greater = count;
+        for (size_t i = 0; i < greater;) {
+            if (keys[i].prefix < pivot) {
+                swap_string_keys(keys, less++, i++);
+            } else if (keys[i].prefix > pivot) {
+                swap_string_keys(keys, i, --greater);
+            } else {
+                i++;
+            }
+        }
+
+        // Nothing told the strings apart, as happens all through a long shared prefix.
+        // Reloading 8 bytes at a time would miss the cache on every string each time,
+        // so find out how far they all agree in one pass and carry on from there.
+        if (less == 0 && greater == count) {
+            if ((pivot & 0xff) == 0) {
+                qsort(keys, count, sizeof(StringKey), compare_string_key_index);
+                return;
+            }
+            depth += 8;
+            depth += common_prefix(keys, count, depth) / 8 * 8;
+            for (size_t i = 0; i < count; i++) {
+                keys[i].prefix = string_prefix(keys[i].string, depth);
+            }
+            continue;
+        }
+
+        // the equal ones go on with their next 8 bytes, unless they all ended here
+        StringKey * equal = keys + less;
+        size_t equal_count = greater - less;
+        if ((pivot & 0xff) != 0) {
+            for (size_t i = 0; i < equal_count; i++) {
+                equal[i].prefix = string_prefix(equal[i].string, depth + 8);
+            }
+            string_sort(equal, equal_count, depth + 8);
+        } else {
+            qsort(equal, equal_count, sizeof(StringKey), compare_string_key_index);
+        }
+
+        // recurse into the smaller side and loop on the larger one, so the stack stays shallow
+        size_t greater_count = count - greater;
+        if (less < greater_count) {
+            string_sort(keys, less, depth);
+            keys += greater;
+            count = greater_count;
+        } else {
+            string_sort(keys + greater, greater_count, depth);
+            count = less;
+        }
+    }
+    string_insertion_sort(keys, count, depth);
+}
+
+// Sorts a list whose elements are all NUL-terminated strings into strcmp order.
+// Much faster than list_merge_sort with a strcmp comparator, above all when the
+// strings share long prefixes: every string is read 8 bytes at a time and each
+// byte only about once, instead of once per comparison. Equal strings keep their
+// relative order.
+// returns 0 on success, -1 on failure
+int list_sort_strings(LinkedList *list) {
+    if (list == NULL || list_make_private(list) != 0) return -1;
+    if (list->size < 2) return 0;
+
+    size_t count = list->size;
+    StringKey * keys = malloc(count * sizeof(StringKey));
+    if (keys == NULL) return -1;
+    LinkedListNode * cursor = list->head;
+    for (size_t i = 0; i < count; i++, cursor = cursor->next) {
+        keys[i].string = cursor->data;
+        keys[i].prefix = string_prefix(keys[i].string, 0);
+        keys[i].node = cursor;
+        keys[i].index = i;
+    }
+
+    string_sort(keys, count, 0);
+
+    for (size_t i = 0; i + 1 < count; i++) {
+        keys[i].node->next = keys[i + 1].node;
+    }
+    keys[count - 1].node->next = NULL;
+    list->head = keys[0].node;
+    list->tail = keys[count - 1].node;
+    list_handle_relink(list, count);
+
+    free(keys);
+    return 0;
+};
+
+// Removes every element pred returns nonzero for, in a single pass.
+// The matching nodes are unlinked first and then freed together, with
+// free_func (if not NULL) applied to their data.
+// returns the number of elements removed
+size_t list_remove_if(LinkedList *list, int (*pred)(const void *data, void *ctx), void *ctx,
+                      void (*free_func)(void *)) {
+    if (list == NULL || pred == NULL || list_make_private(list) != 0) return 0;
+
+    LinkedListNode kept;
+    LinkedListNode *kept_last = &kept;
+    LinkedListNode removed;
+    LinkedListNode *removed_last = &removed;
+    size_t count = 0;
+
+    for (LinkedListNode * cursor = list->head; cursor != NULL; cursor = cursor->next) {
+        if (pred(cursor->data, ctx)) {
+            removed_last->next = cursor;
+            removed_last = cursor;
+            count++;
+        } else {
+            kept_last->next = cursor;
+            kept_last = cursor;
+        }
+    }
+    if (count == 0) return 0;
+    kept_last->next = NULL;
+    removed_last->next = NULL;
+
+    list->head = kept.next;
+    list->tail = kept_last != &kept ? kept_last : NULL;
+    list->size -= count;
+
+    // free the unlinked nodes as one batch
+    LinkedListNode * cursor = removed.next;
+    while (cursor != NULL) {
+        LinkedListNode * to_delete = cursor;
+        cursor = cursor->next;
+
+        list_index_erase(list, to_delete);
+        if (free_func != NULL) {
+            free_func(to_delete->data);
+        }
+        list_node_release(list, to_delete);
+    }
+    list_handle_relink(list, list->size);
+    return count;
+};
+
+// Gets list ready to hand nodes to other lists, and creates an empty list that can take them
+// returns NULL on failure
+static LinkedList *create_receiver(LinkedList *list) {
+    // nodes kept in a header cannot move to another list, and shared ones cannot be relinked
+    if (list_spill_inline(list) != 0 || list_make_private(list) != 0) return NULL;
+    LinkedList * receiver = create(list->arena);
+    // the nodes it gets are ordinary ones, so it must not keep any in its header
+    if (receiver != NULL) receiver->inline_mode = 0;
+    return receiver;
+}
+
+// Appends a node that left list to receiver, handles belong to a list and do not follow it
+static void hand_over(LinkedList *list, LinkedList *receiver, LinkedListNode *node) {
+    list_handle_forget(list, node);
+    if (receiver->head == NULL) {
+        receiver->head = node;
+    } else {
+        receiver->tail->next = node;
+    }
+    receiver->tail = node;
+    receiver->size++;
+}
+
+// Splits the list in two in a single pass: the elements pred returns nonzero for
+// stay, the others move to a new list that is returned. Nodes are relinked, not
+// copied, and both lists keep the elements in their original order. The new list
+// lives in the same arena as list, if any, and has to be destroyed by the caller.
+// returns the new list, NULL on failure (list is left as it was)
+LinkedList *list_partition(LinkedList *list, int (*pred)(const void *data, void *ctx), void *ctx) {
+    if (list == NULL || pred == NULL) return NULL;
+    LinkedList * rest = create_receiver(list);
+    if (rest == NULL) return NULL;
+
+    LinkedListNode kept;
+    LinkedListNode *kept_last = &kept;
+    for (LinkedListNode * cursor = list->head; cursor != NULL; cursor = cursor->next) {
+        if (pred(cursor->data, ctx)) {
+            kept_last->next = cursor;
+            kept_last = cursor;
+        } else {
+            hand_over(list, rest, cursor);
+        }
+    }
+    if (rest->size == 0) return rest;
+    kept_last->next = NULL;
+    rest->tail->next = NULL;
+
+    list->head = kept_last != &kept ? kept.next : NULL;
+    list->tail = kept_last != &kept ? kept_last : NULL;
+    list->size -= rest->size;
+    list_index_rebuild(list);
+    list_handle_relink(list, list->size);
+    return rest;
+};
+
+// Moves every element to one of nbuckets new lists in a single pass, the one at
+// out_lists[key_fn(data)]. Elements whose key is nbuckets or more stay in list.
+// Nodes are relinked, not copied, and every list keeps the elements in their
+// original order. The new lists live in the same arena as list, if any, and have
+// to be destroyed by the caller.
+// returns 0 on success, -1 on failure (list is left as it was, no lists are created)
+int list_group_by(LinkedList *list, size_t (*key_fn)(const void *data), size_t nbuckets, LinkedList **out_lists) {
+    if (list == NULL || key_fn == NULL || nbuckets == 0 || out_lists == NULL) return -1;
+    for (size_t i = 0; i < nbuckets; i++) {
+        out_lists[i] = create_receiver(list);
+        if (out_lists[i] == NULL) {
+            while (i > 0) {
+                list_destroy_unrecorded(out_lists[--i], NULL);
+                out_lists[i] = NULL;
+            }
+            return -1;
+        }
+    }
+
+    LinkedListNode kept;
+    LinkedListNode *kept_last = &kept;
+    size_t moved = 0;
+    for (LinkedListNode * cursor = list->head; cursor != NULL; cursor = cursor->next) {
+        size_t key = key_fn(cursor->data);
+        if (key < nbuckets) {
+            hand_over(list, out_lists[key], cursor);
+            moved++;
+        } else {
+            kept_last->next = cursor;
+            kept_last = cursor;
+        }
+    }
+    if (moved == 0) return 0;
+    for (size_t i = 0; i < nbuckets; i++) {
+        if (out_lists[i]->tail != NULL) out_lists[i]->tail->next = NULL;
+    }
+    kept_last->next = NULL;
+
+    list->head = kept_last != &kept ? kept.next : NULL;
+    list->tail = kept_last != &kept ? kept_last : NULL;
+    list->size -= moved;
+    list_index_rebuild(list);
+    list_handle_relink(list, list->size);
+    return 0;
+};
+
+
+// Takes an O(1) snapshot of the list: a read-only list that keeps showing the
+// elements the list has right now. It shares every node with the list, which
+// copies nodes only when a later change would otherwise show through.
+// returns NULL on failure
+LinkedList *list_snapshot(LinkedList *list) {
+    if (list == NULL || list_spill_inline(list) != 0) return NULL;
+
+    LinkedList * snapshot;
+    if (list->arena != NULL) {
+        snapshot = list_arena_alloc(list->arena, sizeof(LinkedList));
+    } else {
+        snapshot = malloc(sizeof(LinkedList));
+    }
+    if (snapshot == NULL) return NULL;
+
+    snapshot->size = list->size;
+    snapshot->head = list->head;
+    snapshot->tail = list->tail;
+    snapshot->arena = list->arena;
+    snapshot->index = NULL;
+    snapshot->handles = NULL;
+    snapshot->record_id = 0;
+    snapshot->read_only = 1;
+    snapshot->shared = 0;
+    snapshot->inline_mode = 0;
+    snapshot->inline_used = 0;
+
+    if (list->head != NULL) {
+        list->head->refs++;
+    }
+    if (!list->read_only) {
+        list->shared = 1;
+    }
+    return snapshot;
+};
@@ -2,6 +2,14 @@
 #define LINKED_LIST_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "list_arena.h"
+#include "list_deque.h"
+#include "list_intrusive.h"
+#include "list_lru_cache.h"
+#include "list_record.h"
+#include "list_trace.h"
 
 // Our linked list structure.
 typedef struct LinkedList LinkedList;
@@ -10,9 +18,17 @@ typedef struct LinkedListNode LinkedListNode;
 
 // Linked list functions
 
-// Creates and initializes an empty linked list
+// Creates and initializes an empty linked list.
+// The first 8 elements are kept inside the list itself, so small lists cost a
+// single allocation; a list that grows past that moves to separate nodes for good.
 LinkedList *list_create(void);
 
+// Creates an empty linked list that takes its header, all of its nodes and its
+// index and handle tables from arena.
+// Destroying it without a free function is a no-op, the memory comes back
+// when the arena is reset or destroyed.
+LinkedList *list_create_in_arena(ListArena *arena);
+
 // Inserts a new node at the end of the list
 // returns 0 on success. -1 on failure
 int list_add(LinkedList *list, void *data);
@@ -21,6 +37,42 @@ int list_add(LinkedList *list, void *data);
 // Returns 0 if successful, -1 if index is out of bounds
 int list_insert_at(LinkedList *list, size_t index, void *data);
 
+// Handles
+
+// A handle names one element of one list and lets it be read, removed or
+// inserted after in O(1), without walking to its index. A handle stays valid
+// while its element is in the list, however the list is sorted or changed
+// around it. Once the element is removed (or moved to another list by a merge)
+// the handle is stale and every function taking it fails instead of touching
+// the list. 0 is never a valid handle.
+typedef uint64_t ListHandle;
+
+// Same as list_add, and stores a handle to the new element in *out_handle
+// returns 0 on success, -1 on failure
+int list_add_with_handle(LinkedList *list, void *data, ListHandle *out_handle);
+
+// Same as list_insert_at, and stores a handle to the new element in *out_handle
+// returns 0 on success, -1 on failure
+int list_insert_at_with_handle(LinkedList *list, size_t index, void *data, ListHandle *out_handle);
+
+// Gets a handle to the element at index, walking to it once
+// returns 0 on success, -1 on failure
+int list_handle_at(LinkedList *list, size_t index, ListHandle *out_handle);
+
+// Fetches the element a handle refers to in O(1)
+// returns 0 on success, -1 if the handle is stale or not from this list
+int list_get_handle(LinkedList *list, ListHandle handle, void **out_data);
+
+// Removes the element a handle refers to in O(1) and stores it in *out_data
+// (out_data may be NULL). The handle is stale afterwards.
+// returns 0 on success, -1 if the handle is stale or not from this list
+int list_remove_handle(LinkedList *list, ListHandle handle, void **out_data);
+
+// Inserts data right after the element a handle refers to in O(1), and stores a
+// handle to the new element in *out_handle (out_handle may be NULL)
+// returns 0 on success, -1 if the handle is stale or not from this list, or on failure
+int list_insert_after_handle(LinkedList *list, ListHandle handle, void *data, ListHandle *out_handle);
+
 // fetches an element at specified index
 // returns 0 on sucsess, -1 on failure
 int list_get_at(LinkedList *list, size_t index, void **out_data);
@@ -29,6 +81,41 @@ int list_get_at(LinkedList *list, size_t index, void **out_data);
 // returns 0 on sucsess, -1 on failure
 int list_remove_at(LinkedList *list, size_t index, void **out_data);
 
+// Inserts n items at once, with the same result as calling
+// list_insert_at(list, indices[i], items[i]) for i = 0 .. n-1 in turn,
+// so every index counts the items inserted before it. Unlike those calls it
+// walks the list only once, as far as the furthest insert, in O(n log n) on top.
+// Either all items are inserted or, on failure, none are.
+// returns 0 on success, -1 on failure (including an index out of bounds at its turn)
+int list_insert_many(LinkedList *list, const size_t *indices, void *const *items, size_t n);
+
+// Fetches the elements at n indices with a single walk over the list, as far
+// as the highest index, storing the element at indices[i] in out[i].
+// Indices may come in any order and repeat.
+// returns 0 on success, -1 on failure (nothing is stored if an index is out of bounds)
+int list_get_many(LinkedList *list, const size_t *indices, void **out, size_t n);
+
+// Removes every element pred returns nonzero for, in a single pass,
+// applying free_func (if not NULL) to the data of each removed element
+// returns the number of elements removed
+size_t list_remove_if(LinkedList *list, int (*pred)(const void *data, void *ctx), void *ctx,
+                      void (*free_func)(void *));
+
+// Splits the list in two in a single pass: the elements pred returns nonzero for
+// stay, the others move to a new list that is returned. Nodes are relinked, not
+// copied, and both lists keep the elements in their original order. The new list
+// lives in the same arena as list, if any, and has to be destroyed by the caller.
+// returns the new list, NULL on failure (list is left as it was)
+LinkedList *list_partition(LinkedList *list, int (*pred)(const void *data, void *ctx), void *ctx);
+
+// Moves every element to one of nbuckets new lists in a single pass, the one at
+// out_lists[key_fn(data)]. Elements whose key is nbuckets or more stay in list.
+// Nodes are relinked, not copied, and every list keeps the elements in their
+// original order. The new lists live in the same arena as list, if any, and have
+// to be destroyed by the caller.
+// returns 0 on success, -1 on failure (list is left as it was, no lists are created)
+int list_group_by(LinkedList *list, size_t (*key_fn)(const void *data), size_t nbuckets, LinkedList **out_lists);
+
 // Returns the size of the list
 size_t list_size(const LinkedList *list);
 
@@ -37,6 +124,54 @@ size_t list_size(const LinkedList *list);
 // and only frees the list itself.
 void list_destroy(LinkedList *list, void (*free_func)(void *));
 
+// Hands the list to a background thread that frees its nodes, and applies
+// free_func (if not NULL) to their data, the same way list_destroy does.
+// Returns in O(1). The list must not be used afterwards, and whatever
+// free_func touches has to stay valid until the list is actually freed.
+// Lists in an arena are destroyed right away instead, since the arena could be
+// reset or destroyed before the background thread got to them.
+void list_destroy_async(LinkedList *list, void (*free_func)(void *));
+
+// Waits until every list handed to list_destroy_async so far is freed
+void list_reclaimer_drain(void);
+
+// Frees everything still queued and stops the background thread.
+// Call it before exiting, a later list_destroy_async starts a new thread.
+void list_reclaimer_shutdown(void);
+
+// Destroys the list like list_destroy, but runs free_func and frees the nodes
+// on up to nthreads threads (the calling thread included), for when free_func
+// is expensive. free_func has to be safe to call from several threads at once.
+// The list is split into one segment per thread, so no more threads run than
+// the list has elements. Lists that share nodes with snapshots, and arena lists
+// without a free_func, are destroyed on the calling thread alone.
+void list_destroy_parallel(LinkedList *list, void (*free_func)(void *), size_t nthreads);
+
+// Node caches
+
+// Nodes of lists that are not in an arena come from a small per-thread cache,
+// refilled from and drained to a shared depot in batches, so threads building
+// lists side by side rarely hit malloc. These calls tune it, none are required.
+
+// Hands the nodes cached by the calling thread to the shared depot, so other
+// threads can use them. Threads do this on their own when they exit.
+void list_node_cache_flush(void);
+
+// Frees the calling thread's cached nodes and everything in the shared depot back to malloc
+void list_node_cache_trim(void);
+
+// Takes an O(1) snapshot of the list: a read-only list that keeps showing the
+// elements the list has right now, however the list changes afterwards.
+// It shares its nodes with the list, and later changes copy only the nodes they
+// touch, so memory grows with the writes made while the snapshot lives.
+// Read it with the usual functions, every function that changes it fails.
+// Release it with list_destroy. The data pointers are shared, not copied: the
+// data has to outlive every snapshot, so only pass free_func to list_destroy
+// once no other view of the same data is left. list_destroy hands free_func only
+// the elements the destroyed list or snapshot holds itself.
+// returns NULL on failure
+LinkedList *list_snapshot(LinkedList *list);
+
 // Linked list iterator functions
 
 // the linked list iterator is an "object" that
@@ -55,6 +190,13 @@ int list_iterator_next(ListIterator *iter, void **out_data);
 // Resets the iterator to the start of the list
 void list_iterator_reset(ListIterator *iter);
 
+// Creates an iterator that hands out the elements of the list in sorted order
+// without sorting the list. The order is stable. Getting the first element costs
+// O(n) and every following one O(log n), so stopping early saves the rest of the sort.
+// The elements are captured when the iterator is created or reset, later changes
+// to the list are not seen. Use it with the other list_iterator functions.
+ListIterator *list_sorted_iterator_create(LinkedList *list, int (*compare)(const void *, const void *));
+
 // Destroys the iterator and frees any allocated memory
 // notice this has nothing to do with the list that this iterator is pointing to
 void list_iterator_destroy(ListIterator *iter);
@@ -74,4 +216,150 @@ LinkedListNode *merge_sort_nodes(LinkedListNode *head, int (*compare)(const void
 
 void list_merge_sort(LinkedList *list, int (*compare)(const void *, const void *));
 
+// Merges the sorted list src into the sorted list dst in linear time.
+// The merge is stable, on ties elements already in dst come first.
+// src is left empty but still has to be destroyed by the caller.
+// Both lists have to take their nodes from the same place (malloc or the same arena).
+// returns 0 on success, -1 on failure
+int list_merge(LinkedList *dst, LinkedList *src, int (*compare)(const void *, const void *));
+
+// Merges k sorted lists into lists[0] in O(n log k).
+// The merge is stable, on ties elements from the list with the lower index come first.
+// Every other list is left empty but still has to be destroyed by the caller.
+// All lists have to take their nodes from the same place (malloc or the same arena).
+// returns 0 on success, -1 on failure
+int list_merge_k(LinkedList **lists, size_t k, int (*compare)(const void *, const void *));
+
+// Tells the external sort how to move elements to and from disk
+typedef struct ListSerializer {
+    // writes one element to out, returns 0 on success
+    int (*write)(const void *data, FILE *out, void *ctx);
+    // reads one element written by write back from in, returns NULL on failure
+    void *(*read)(FILE *in, void *ctx);
+    // optional, bytes an element takes in memory on top of its node, counted against the budget
+    size_t (*mem_size)(const void *data, void *ctx);
+    // optional, frees an element once it has been written out, so memory is actually given back
+    void (*free_func)(void *data);
+    // passed to every callback above
+    void *ctx;
+} ListSerializer;
+
+// Sorts a list that may not fit in memory with an external merge sort.
+// Chunks that fit in mem_budget bytes are sorted and spilled to temporary
+// files in tmpdir (NULL for the system default), then merged back into the list
+// as newly read elements. Lists that fit in the budget are sorted in place.
+// Nothing is taken out of the list before the first run opens, and an element is
+// only freed once the run it went to is written. If spilling fails (a bad tmpdir,
+// a full disk) the list keeps all of its elements, though not in their order.
+// If merging fails the list keeps what was merged back so far, the rest is freed.
+// returns 0 on success, -1 on failure
+int list_external_sort(LinkedList *list, int (*compare)(const void *, const void *),
+                       const ListSerializer *serializer, size_t mem_budget, const char *tmpdir);
+
+// Same as list_external_sort but streams the sorted elements to sink instead
+// of putting them back into the list, which is left empty. The sink takes
+// ownership of each element and returns 0 to continue, anything else to stop.
+// returns 0 on success, -1 on failure
+int list_external_sort_to(LinkedList *list, int (*compare)(const void *, const void *),
+                          const ListSerializer *serializer, size_t mem_budget, const char *tmpdir,
+                          int (*sink)(void *data, void *ctx), void *sink_ctx);
+
+// Moves the k smallest elements, sorted, to the front of the list in O(n log k).
+// The remaining elements follow in their original order. Equal elements keep
+// their relative order. A k of at least the list size sorts the whole list.
+// returns 0 on success, -1 on failure
+int list_partial_sort(LinkedList *list, size_t k, int (*compare)(const void *, const void *));
+
+// Finds the element that would be at index n if the list were sorted, in expected O(n).
+// The list itself is left untouched.
+// returns 0 on success, -1 on failure
+int list_nth_element(LinkedList *list, size_t n, int (*compare)(const void *, const void *), void **out_data);
+
+// Sorts the list by the unsigned 64-bit key key_fn extracts from every element.
+// key_fn is called once per element, the sort itself only looks at the keys, so
+// it never touches the data again. The sort is stable and runs in O(n) passes
+// over a contiguous array of (key, node) pairs, then relinks the nodes.
+// Use list_key_from_int64 or list_key_from_double to build keys from signed or
+// floating point fields so they sort in numeric order.
+// returns 0 on success, -1 on failure
+int list_sort_by_key(LinkedList *list, uint64_t (*key_fn)(const void *data));
+
+// Turns a signed integer into a key that sorts in numeric order
+uint64_t list_key_from_int64(int64_t value);
+
+// Turns a double into a key that sorts in numeric order, negative zero before
+// zero. NaNs sort after infinity, or before negative infinity when their sign bit is set.
+uint64_t list_key_from_double(double value);
+
+// Sorts a list whose elements are all NUL-terminated strings into strcmp order.
+// Much faster than list_merge_sort with a strcmp comparator, above all when the
+// strings share long prefixes: every string is read 8 bytes at a time and each
+// byte only about once, instead of once per comparison. Equal strings keep their
+// relative order.
+// returns 0 on success, -1 on failure
+int list_sort_strings(LinkedList *list);
+
+// Hash index
+
+// Starts keeping a hash index of the list, built from its current contents,
+// that every list operation keeps up to date. hash and equals work on the
+// stored data and equal elements must hash the same.
+// returns 0 on success, -1 on failure
+int list_index_enable(LinkedList *list, size_t (*hash)(const void *data),
+                      int (*equals)(const void *a, const void *b));
+
+// Stops keeping a hash index of the list and frees it
+void list_index_disable(LinkedList *list);
+
+// Looks up an element equal to key through the hash index in expected O(1)
+// returns 0 and stores the element in *out_data if found,
+// -1 if not found or if the list has no index
+int list_find(LinkedList *list, const void *key, void **out_data);
+
+// Checks whether an element equal to key is in the list, through the hash index
+// returns 1 if it is, 0 if it is not or if the list has no index
+int list_contains(LinkedList *list, const void *key);
+
+// Fused filter/map/reduce pipeline
+
+// A pipeline records filter, map and reduce stages and then runs all of them
+// together in one pass over a list, without building intermediate lists.
+typedef struct ListPipeline ListPipeline;
+
+// Creates an empty pipeline
+ListPipeline *list_pipeline_create(void);
+
+// Adds a stage that only lets elements through when filter returns nonzero
+// returns 0 on success, -1 on failure
+int list_pipeline_filter(ListPipeline *pipeline, int (*filter)(const void *data, void *ctx), void *ctx);
+
+// Adds a stage that replaces every element with what map returns for it
+// returns 0 on success, -1 on failure
+int list_pipeline_map(ListPipeline *pipeline, void *(*map)(void *data, void *ctx), void *ctx);
+
+// Adds the final stage, which folds every element into an accumulator starting at init
+// no stage can be added after it
+// returns 0 on success, -1 on failure
+int list_pipeline_reduce(ListPipeline *pipeline, void *(*reduce)(void *acc, void *data, void *ctx),
+                         void *init, void *ctx);
+
+// Runs the pipeline over the list in a single pass, leaving the list untouched.
+// If the pipeline ends in a reduce, its result is stored in *out_result
+// (out_result may be NULL when it is not needed).
+// returns 0 on success, -1 on failure
+int list_pipeline_run(const ListPipeline *pipeline, LinkedList *list, void **out_result);
+
+// Runs the pipeline over the list in a single pass and applies it to the list itself:
+// surviving nodes store the value produced by the map stages, nodes dropped by a
+// filter are unlinked and the value they had when dropped (what the maps before the
+// filter made of it) goes to free_func (if not NULL). Either way the data a map
+// replaces is not freed here, a map that hands back a new value frees the old one itself.
+// If the pipeline ends in a reduce, its result is stored in *out_result.
+// returns 0 on success, -1 on failure
+int list_pipeline_run_in_place(const ListPipeline *pipeline, LinkedList *list,
+                               void (*free_func)(void *), void **out_result);
+
+// Destroys the pipeline, lists it ran over are not affected
+void list_pipeline_destroy(ListPipeline *pipeline);
+
 #endif //LINKED_LIST_H
@@ -0,0 +1,212 @@
+#ifndef LINKED_LIST_INTERNAL_H
+#define LINKED_LIST_INTERNAL_H
+
+// Internal layout of the linked list, shared by the source files that
+// make up the library. Users of the library only see linked_list.h.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "linked_list.h"
+
+typedef struct ListIndex ListIndex;
+typedef struct ListHandles ListHandles;
+
+// Nodes a list keeps inside its own header before it needs any others
+#define LIST_INLINE_NODES 8
+
+// Linked list structures
+struct LinkedListNode {
+    void * data;
+    struct LinkedListNode * next;
+    // references to this node: the list head or the node before it, plus any
+    // snapshot or copied node that shares it. Always 1 unless snapshots exist.
+    unsigned int refs;
+    // slot of the handle to this node plus one, 0 when it has none
+    unsigned int handle;
+};
+
+struct LinkedList {
+    size_t size;
+    struct LinkedListNode * head;
+    struct LinkedListNode * tail;
+    // arena the nodes and this header live in, NULL when they come from malloc
+    ListArena * arena;
+    // optional hash index over the elements, NULL when not enabled. Like the
+    // handle table it comes from the arena for arena lists, so a reset takes it along.
+    ListIndex * index;
+    // handles handed out for nodes of the list, NULL until the first one
+    ListHandles * handles;
+    // set on snapshots, which refuse every change
+    int read_only;
+    // set once a snapshot was taken, nodes may be shared until list_make_private runs
+    int shared;
+    // Small lists keep their nodes right here. While inline_mode is set every node
+    // of the list is one of inline_nodes, inline_used marks the ones taken. The list
+    // spills to ordinary nodes for good when it outgrows them, and before its nodes
+    // can end up in a snapshot or another list, since they die with the header.
+    int inline_mode;
+    unsigned int inline_used;
+    struct LinkedListNode inline_nodes[LIST_INLINE_NODES];
+    // number of the list in the trace being recorded, 0 until it shows up there
+    uint64_t record_id;
+};
+
+// Gets a node from wherever this list keeps its nodes
+// returns NULL on failure
+LinkedListNode *list_node_alloc(LinkedList *list);
+
+// Gives a node back to wherever this list keeps its nodes
+void list_node_release(LinkedList *list, LinkedListNode *node);
+
+// Moves every node of a list out of its header storage into ordinary nodes,
+// for operations that share nodes or hand them to another list.
+// returns 0 on success (also when there was nothing to move), -1 on failure
+int list_spill_inline(LinkedList *list);
+
+// Makes sure the list can hand out one more handle without allocating
+// returns 0 on success, -1 on failure
+int list_handle_reserve(LinkedList *list);
+
+// Gives node, which sits right after prev (NULL for the head), a handle.
+// list_handle_reserve must have succeeded first. A node keeps a single handle,
+// asking again returns the one it has.
+ListHandle list_handle_assign(LinkedList *list, LinkedListNode *node, LinkedListNode *prev);
+
+// Records that node, if it has a handle, now sits right after prev (NULL for the head)
+void list_handle_set_prev(LinkedList *list, LinkedListNode *node, LinkedListNode *prev);
+
+// Makes the handle of a node that leaves the list stale
+void list_handle_forget(LinkedList *list, LinkedListNode *node);
+
+// Moves the handle of old_node over to new_node, which replaces it in the list
+void list_handle_replace(LinkedList *list, LinkedListNode *old_node, LinkedListNode *new_node);
+
+// Points the handles of the first count nodes, and of the one after them, at the
+// nodes now in front of them, for operations that relink more than one link at once
+void list_handle_relink(LinkedList *list, size_t count);
+
+// Makes every handle of the list stale, for when all of its nodes move to another list
+void list_handle_clear(LinkedList *list);
+
+// Frees the handle table of a list
+void list_handle_free(LinkedList *list);
+
+// Does the work of list_add without logging the call, for adds the library makes on its own
+// returns 0 on success, -1 on failure
+int list_add_unrecorded(LinkedList *list, void *data);
+
+// Does the work of list_merge_sort without logging or timing the call, for sorts
+// the library runs as part of another operation
+void list_merge_sort_unrecorded(LinkedList *list, int (*compare)(const void *, const void *));
+
+// Does the work of list_destroy without logging the call, for lists the library
+// destroys on its own or on behalf of a call that was logged already
+void list_destroy_unrecorded(LinkedList *list, void (*free_func)(void *));
+
+// Logs a call on list to the trace being recorded, if any. index is only
+// recorded for the positional calls.
+void list_record_call(ListRecordOp op, LinkedList *list, size_t index);
+
+// Logs a call on the iterator with *iterator_id, which is over list, to the trace
+// being recorded, if any. An iterator without an id (0) gets one. list may be
+// NULL when it must not be touched, the call is then recorded on no list.
+void list_record_iterator_call(ListRecordOp op, LinkedList *list, uint64_t *iterator_id);
+
+// Starts timing a traced call
+// returns the start time, or 0 when tracing is off
+uint64_t list_trace_begin(void);
+
+// Records a traced call that list_trace_begin returned start for
+void list_trace_end(ListTraceOp op, uint64_t start);
+
+// Gets a node from the calling thread's node cache
+// returns NULL on failure
+LinkedListNode *list_node_cache_alloc(void);
+
+// Gives a node to the calling thread's node cache, whichever thread allocated it
+void list_node_cache_free(LinkedListNode *node);
+
+// Destroys a list at most max_nodes nodes at a time, freeing them the way
+// list_destroy would, so long lists can be torn down in bounded steps
+// returns 1 once the list is completely gone, 0 if it has to be called again
+int list_destroy_batch(LinkedList *list, void (*free_func)(void *), size_t max_nodes);
+
+// Copies every node the list still shares with a snapshot, so it can be relinked freely.
+// Operations that move nodes around call this first, it costs nothing for unshared lists.
+// returns 0 on success, -1 on failure
+int list_make_private(LinkedList *list);
+
+// Open addressing hash table of item pointers, shared by the hash index and the LRU cache
+
+#define LIST_HASH_NO_SLOT SIZE_MAX
+
+typedef struct ListHashSlot {
+    // NULL when the slot is free
+    void * item;
+    size_t hash;
+} ListHashSlot;
+
+typedef struct ListHashTable {
+    ListHashSlot * slots;
+    // always a power of two
+    size_t capacity;
+    size_t count;
+    // arena the slots come from, NULL when they come from malloc
+    ListArena * arena;
+} ListHashTable;
+
+// Sets up an empty table with room for count items, whose slots come from arena
+// (NULL for malloc)
+// returns 0 on success, -1 on failure
+int list_hash_table_init(ListHashTable *table, size_t count, ListArena *arena);
+
+// Frees the slots of a table
+void list_hash_table_free(ListHashTable *table);
+
+// Places an item in the table, which must have room for it
+void list_hash_table_put(ListHashTable *table, void *item, size_t hash);
+
+// Makes sure count more items fit without the table having to grow
+// returns 0 on success, -1 on failure
+int list_hash_table_reserve(ListHashTable *table, size_t count);
+
+// Finds the slot of an item with the given hash that matches(item, key, ctx) accepts
+// returns LIST_HASH_NO_SLOT if there is none
+size_t list_hash_table_find(const ListHashTable *table, size_t hash,
+                            int (*matches)(const void *item, const void *key, const void *ctx),
+                            const void *key, const void *ctx);
+
+// Finds the slot holding item itself, which was put with hash
+// returns LIST_HASH_NO_SLOT if the item is not in the table
+size_t list_hash_table_find_item(const ListHashTable *table, const void *item, size_t hash);
+
+// Empties a slot, pulling later entries of the probe run back into the hole
+void list_hash_table_erase(ListHashTable *table, size_t slot);
+
+// Empties the table without giving up its capacity
+void list_hash_table_clear(ListHashTable *table);
+
+// Hash index upkeep, all of these do nothing for lists without an index
+
+// Adds a node to the index of its list
+// returns 0 on success, -1 on failure
+int list_index_insert(LinkedList *list, LinkedListNode *node);
+
+// Removes a node from the index of its list, its data must not have changed since it was added
+void list_index_erase(LinkedList *list, LinkedListNode *node);
+
+// Makes sure count more nodes can be indexed without allocating
+// returns 0 on success, -1 on failure
+int list_index_reserve(LinkedList *list, size_t count);
+
+// Indexes the list again from scratch, after operations that move or change many nodes.
+// Never allocates, call list_index_reserve first if the list may have grown.
+void list_index_rebuild(LinkedList *list);
+
+// Points the index entry of old_node at new_node, which holds the same data
+void list_index_replace(LinkedList *list, LinkedListNode *old_node, LinkedListNode *new_node);
+
+// Frees the index of a list
+void list_index_free(LinkedList *list);
+
+#endif //LINKED_LIST_INTERNAL_H
@@ -0,0 +1,260 @@
+#if defined(__linux__)
+// mmap, MAP_ANONYMOUS and MADV_HUGEPAGE are not part of plain C11
+#define _DEFAULT_SOURCE
+#endif
+
+#include "list_arena.h"
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#if defined(MADV_HUGEPAGE)
+#define LIST_ARENA_HUGE_PAGES 1
+#endif
+#endif
+
+#define LIST_ARENA_DEFAULT_BLOCK (64 * 1024)
+#define LIST_ARENA_ALIGN (_Alignof(max_align_t))
+// transparent huge pages are 2MB on x86-64 and arm64 with 4KB base pages
+#define LIST_ARENA_HUGE_PAGE (2 * 1024 * 1024)
+#define LIST_ARENA_DEFAULT_HUGE_BLOCK (16 * LIST_ARENA_HUGE_PAGE)
+
+// Arena structures
+typedef struct ArenaBlock {
+    struct ArenaBlock * next;
+    size_t capacity;
+    size_t used;
+    // set when the block was mapped (and then its length) rather than malloced
+    size_t mapped_size;
+    // set when the kernel accepted the huge page advice for the block
+    int huge;
+    // block memory follows the header
+} ArenaBlock;
+
+struct ListArena {
+    size_t block_size;
+    ArenaBlock * first;
+    ArenaBlock * current;
+    int huge;
+};
+
+// Rounds n up to the arena alignment
+static size_t align_up(size_t n) {
+    return (n + LIST_ARENA_ALIGN - 1) & ~(LIST_ARENA_ALIGN - 1);
+}
+
+// Start of the usable memory of a block, right after its (aligned) header
+static char *block_memory(ArenaBlock *block) {
+    return (char *)block + align_up(sizeof(ArenaBlock));
+}
+
+#if defined(LIST_ARENA_HUGE_PAGES)
+// Maps a block aligned to the huge page size and asks for transparent huge pages
+// returns NULL if the memory could not be mapped
+static ArenaBlock *block_map_huge(size_t capacity) {
+    size_t size = align_up(sizeof(ArenaBlock)) + capacity;
+    size = (size + LIST_ARENA_HUGE_PAGE - 1) & ~((size_t)LIST_ARENA_HUGE_PAGE - 1);
+
+    // map one huge page extra and trim both ends, so the block starts on a huge page boundary
+    size_t reserve = size + LIST_ARENA_HUGE_PAGE;
+    char * base = mmap(NULL, reserve, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return NULL;
+    uintptr_t start = ((uintptr_t)base + LIST_ARENA_HUGE_PAGE - 1) & ~((uintptr_t)LIST_ARENA_HUGE_PAGE - 1);
+    char * aligned = (char *)start;
+    if (aligned > base) munmap(base, (size_t)(aligned - base));
+    if (base + reserve > aligned + size) munmap(aligned + size, (size_t)(base + reserve - (aligned + size)));
+
+    ArenaBlock * block = (ArenaBlock *)aligned;
+    block->huge = madvise(aligned, size, MADV_HUGEPAGE) == 0;
+    block->mapped_size = size;
+    block->capacity = size - align_up(sizeof(ArenaBlock));
+    return block;
+}
+#endif
+
+// Allocates a block with room for at least capacity bytes,
+// huge page backed when asked for and available, from malloc otherwise
+static ArenaBlock *block_create(size_t capacity, int huge) {
+    ArenaBlock * block = NULL;
+#if defined(LIST_ARENA_HUGE_PAGES)
+    if (huge) block = block_map_huge(capacity);
+#else
+    (void)huge;
+#endif
+    if (block == NULL) {
+        block = malloc(align_up(sizeof(ArenaBlock)) + capacity);
+        if (block == NULL) return NULL;
+        block->capacity = capacity;
+        block->mapped_size = 0;
+        block->huge = 0;
+    }
+    block->next = NULL;
+    block->used = 0;
+    return block;
+}
+
+static void block_free(ArenaBlock *block) {
+#if defined(LIST_ARENA_HUGE_PAGES)
+    if (block->mapped_size != 0) {
+        munmap(block, block->mapped_size);
+        return;
+    }
+#endif
+    free(block);
+}
+
+// Creates an arena that grabs memory in blocks of block_size bytes
+// passing 0 uses a default block size
+// returns NULL on failure
+ListArena *list_arena_create(size_t block_size) {
+    ListArena * arena = malloc(sizeof(ListArena));
+    if (arena == NULL) return NULL;
+
+    arena->block_size = block_size == 0 ? LIST_ARENA_DEFAULT_BLOCK : align_up(block_size);
+    arena->huge = 0;
+    arena->first = block_create(arena->block_size, 0);
+    if (arena->first == NULL) {
+        free(arena);
+        return NULL;
+    }
+    arena->current = arena->first;
+    return arena;
+};
+
+// Creates an arena whose blocks are mapped with mmap on huge page boundaries and
+// advised to use transparent huge pages, which cuts TLB misses when walking very
+// long lists. block_size is rounded up to whole huge pages, 0 uses a default of 32MB.
+// Where huge pages or mmap are not available the arena quietly uses normal
+// pages or malloc, list_arena_stats tells what was actually obtained.
+// returns NULL on failure
+ListArena *list_arena_create_huge(size_t block_size) {
+    ListArena * arena = malloc(sizeof(ListArena));
+    if (arena == NULL) return NULL;
+
+    if (block_size == 0) block_size = LIST_ARENA_DEFAULT_HUGE_BLOCK;
+    arena->block_size = (block_size + LIST_ARENA_HUGE_PAGE - 1) & ~((size_t)LIST_ARENA_HUGE_PAGE - 1);
+    // the first block header takes a little of the first huge page, keep the block within whole pages
+    arena->block_size -= align_up(sizeof(ArenaBlock));
+    arena->huge = 1;
+    arena->first = block_create(arena->block_size, 1);
+    if (arena->first == NULL) {
+        free(arena);
+        return NULL;
+    }
+    arena->current = arena->first;
+    return arena;
+};
+
+// Hands out size bytes, aligned for any type, from the arena
+// returns NULL on failure
+void *list_arena_alloc(ListArena *arena, size_t size) {
+    if (arena == NULL || size == 0) return NULL;
+    size = align_up(size);
+
+    ArenaBlock * block = arena->current;
+    while (block->capacity - block->used < size) {
+        // blocks kept from before a reset are reused before growing the chain
+        if (block->next != NULL && block->next->capacity >= size) {
+            block = block->next;
+            block->used = 0;
+            continue;
+        }
+
+        // the request does not fit the block we have, so splice a fresh one in after it
+        ArenaBlock * fresh = block_create(size > arena->block_size ? size : arena->block_size, arena->huge);
+        if (fresh == NULL) return NULL;
+        fresh->next = block->next;
+        block->next = fresh;
+        block = fresh;
+    }
+
+    arena->current = block;
+    void * memory = block_memory(block) + block->used;
+    block->used += size;
+    return memory;
+};
+
+// Forgets everything allocated from the arena in O(1).
+// The blocks are kept and reused, so every list created in the arena
+// must be considered gone after this call.
+void list_arena_reset(ListArena *arena) {
+    if (arena == NULL) return;
+    arena->current = arena->first;
+    arena->first->used = 0;
+};
+
+// Releases the arena and all of its blocks
+void list_arena_destroy(ListArena *arena) {
+    if (arena == NULL) return;
+    ArenaBlock * cursor = arena->first;
+    while (cursor != NULL) {
+        ArenaBlock * to_delete = cursor;
+        cursor = cursor->next;
+        block_free(to_delete);
+    }
+    free(arena);
+};
+
+#if defined(LIST_ARENA_HUGE_PAGES)
+// Adds up the AnonHugePages the kernel reports in /proc/self/smaps for the mapped blocks
+// returns 0 if smaps cannot be read
+static size_t huge_bytes_backed(const ListArena *arena) {
+    FILE * smaps = fopen("/proc/self/smaps", "r");
+    if (smaps == NULL) return 0;
+
+    size_t total = 0;
+    // bytes of the current mapping that belong to the arena
+    size_t overlap = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), smaps) != NULL) {
+        uintptr_t start;
+        uintptr_t end;
+        size_t kb;
+        if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR " ", &start, &end) == 2) {
+            overlap = 0;
+            for (ArenaBlock * block = arena->first; block != NULL; block = block->next) {
+                if (block->mapped_size == 0) continue;
+                uintptr_t block_start = (uintptr_t)block;
+                uintptr_t block_end = block_start + block->mapped_size;
+                uintptr_t from = start > block_start ? start : block_start;
+                uintptr_t to = end < block_end ? end : block_end;
+                if (from < to) overlap += to - from;
+            }
+        } else if (overlap > 0 && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+            // the kernel may have merged a block with a neighbouring mapping and only
+            // reports the mapping as a whole, so never count more than the arena covers
+            size_t bytes = kb * 1024;
+            total += bytes < overlap ? bytes : overlap;
+        }
+    }
+    fclose(smaps);
+    return total;
+}
+#endif
+
+// Reports how much memory the arena holds and how much of it is huge page backed
+// returns 0 on success, -1 on failure
+int list_arena_stats(const ListArena *arena, ListArenaStats *out_stats) {
+    if (arena == NULL || out_stats == NULL) return -1;
+
+    ListArenaStats stats = {0};
+    int active = 1;
+    for (ArenaBlock * block = arena->first; block != NULL; block = block->next) {
+        stats.blocks++;
+        stats.reserved_bytes += block->capacity;
+        // blocks after the current one are left over from before a reset
+        if (active) stats.used_bytes += block->used;
+        if (block == arena->current) active = 0;
+        if (block->mapped_size != 0) stats.mapped_blocks++;
+        if (block->huge) stats.huge_page_blocks++;
+    }
+#if defined(LIST_ARENA_HUGE_PAGES)
+    if (stats.mapped_blocks > 0) stats.huge_page_bytes = huge_bytes_backed(arena);
+#endif
+    *out_stats = stats;
+    return 0;
+};
@@ -0,0 +1,59 @@
+#ifndef LIST_ARENA_H
+#define LIST_ARENA_H
+
+#include <stddef.h>
+
+// A bump arena that lists can take their nodes (and header) from.
+// Allocating from it is a pointer bump and nothing is ever freed on its own;
+// the whole arena is recycled at once with list_arena_reset.
+typedef struct ListArena ListArena;
+
+// Creates an arena that grabs memory in blocks of block_size bytes
+// passing 0 uses a default block size
+// returns NULL on failure
+ListArena *list_arena_create(size_t block_size);
+
+// Creates an arena whose blocks are mapped with mmap on huge page boundaries and
+// advised to use transparent huge pages, which cuts TLB misses when walking very
+// long lists. block_size is rounded up to whole huge pages, 0 uses a default of 32MB.
+// Where huge pages or mmap are not available the arena quietly uses normal
+// pages or malloc, list_arena_stats tells what was actually obtained.
+// returns NULL on failure
+ListArena *list_arena_create_huge(size_t block_size);
+
+// Hands out size bytes, aligned for any type, from the arena
+// returns NULL on failure
+void *list_arena_alloc(ListArena *arena, size_t size);
+
+// Forgets everything allocated from the arena in O(1).
+// The blocks are kept and reused, so every list created in the arena
+// must be considered gone after this call. Their index and handle tables
+// live in the arena as well, nothing is left behind.
+void list_arena_reset(ListArena *arena);
+
+// Releases the arena and all of its blocks
+void list_arena_destroy(ListArena *arena);
+
+// What an arena holds, filled in by list_arena_stats
+typedef struct ListArenaStats {
+    size_t blocks;
+    // usable bytes over all blocks
+    size_t reserved_bytes;
+    // bytes handed out since the last reset
+    size_t used_bytes;
+    // blocks mapped with mmap instead of taken from malloc
+    size_t mapped_blocks;
+    // blocks for which the kernel accepted the huge page advice
+    size_t huge_page_blocks;
+    // bytes the kernel actually backs with huge pages (Linux only, 0 elsewhere).
+    // Pages are only backed once touched, so check after filling the arena.
+    // The kernel reports huge pages per mapping, and a block may share its mapping
+    // with a neighbour, so this is an upper bound capped at the mapped block sizes.
+    size_t huge_page_bytes;
+} ListArenaStats;
+
+// Reports how much memory the arena holds and how much of it is huge page backed
+// returns 0 on success, -1 on failure
+int list_arena_stats(const ListArena *arena, ListArenaStats *out_stats);
+
+#endif //LIST_ARENA_H
@@ -0,0 +1,236 @@
+#include "list_deque.h"
+#include <stddef.h>
+#include <stdlib.h>
+
+// Chunked deque
+//
+// Elements live in blocks of DEQUE_BLOCK slots. A map holds the blocks in use
+// as a ring, so blocks can be added or dropped at either end by moving the ring
+// head instead of shifting the map. Element i sits at position start + i counted
+// over the blocks in order, which makes indexed access a division and a lookup.
+
+#define DEQUE_BLOCK 128
+#define DEQUE_MIN_MAP 8
+// emptied blocks kept around for reuse, so a deque that hovers around a block
+// boundary does not allocate and free on every push and pop
+#define DEQUE_MAX_SPARE 4
+
+typedef struct DequeBlock {
+    void * slots[DEQUE_BLOCK];
+} DequeBlock;
+
+struct ListDeque {
+    // ring of blocks in use, map_capacity is always a power of two
+    DequeBlock ** map;
+    size_t map_capacity;
+    size_t map_head;
+    size_t blocks;
+    // position of the first element in the first block
+    size_t start;
+    size_t size;
+    DequeBlock * spare[DEQUE_MAX_SPARE];
+    size_t spare_count;
+};
+
+// Creates an empty deque
+// returns NULL on failure
+ListDeque *list_deque_create(void) {
+    ListDeque * deque = malloc(sizeof(ListDeque));
+    if (deque == NULL) return NULL;
+    deque->map = malloc(DEQUE_MIN_MAP * sizeof(DequeBlock *));
+    if (deque->map == NULL) {
+        free(deque);
+        return NULL;
+    }
+    deque->map_capacity = DEQUE_MIN_MAP;
+    deque->map_head = 0;
+    deque->blocks = 0;
+    deque->start = 0;
+    deque->size = 0;
+    deque->spare_count = 0;
+    return deque;
+};
+
+// The i-th block in use
+static DequeBlock *block_at(const ListDeque *deque, size_t i) {
+    return deque->map[(deque->map_head + i) & (deque->map_capacity - 1)];
+}
+
+// Gets an empty block, a spare one if there is any
+// returns NULL on failure
+static DequeBlock *block_take(ListDeque *deque) {
+    if (deque->spare_count > 0) return deque->spare[--deque->spare_count];
+    return malloc(sizeof(DequeBlock));
+}
+
+// Keeps an emptied block for reuse, or frees it when enough are kept
+static void block_give_back(ListDeque *deque, DequeBlock *block) {
+    if (deque->spare_count < DEQUE_MAX_SPARE) {
+        deque->spare[deque->spare_count++] = block;
+    } else {
+        free(block);
+    }
+}
+
+// Makes sure the map has room for one more block, unrolling the ring into a bigger map
+// returns 0 on success, -1 on failure
+static int map_reserve(ListDeque *deque) {
+    if (deque->blocks < deque->map_capacity) return 0;
+
+    size_t capacity = deque->map_capacity * 2;
+    DequeBlock ** map = malloc(capacity * sizeof(DequeBlock *));
+    if (map == NULL) return -1;
+    for (size_t i = 0; i < deque->blocks; i++) {
+        map[i] = block_at(deque, i);
+    }
+    free(deque->map);
+    deque->map = map;
+    deque->map_capacity = capacity;
+    deque->map_head = 0;
+    return 0;
+}
+
+// Adds an empty block in front of the first one
+// returns 0 on success, -1 on failure
+static int add_front_block(ListDeque *deque) {
+    if (map_reserve(deque) != 0) return -1;
+    DequeBlock * block = block_take(deque);
+    if (block == NULL) return -1;
+    deque->map_head = (deque->map_head - 1) & (deque->map_capacity - 1);
+    deque->map[deque->map_head] = block;
+    deque->blocks++;
+    return 0;
+}
+
+// Adds an empty block after the last one
+// returns 0 on success, -1 on failure
+static int add_back_block(ListDeque *deque) {
+    if (map_reserve(deque) != 0) return -1;
+    DequeBlock * block = block_take(deque);
+    if (block == NULL) return -1;
+    deque->map[(deque->map_head + deque->blocks) & (deque->map_capacity - 1)] = block;
+    deque->blocks++;
+    return 0;
+}
+
+// Drops every block once the deque runs empty
+static void drop_all_blocks(ListDeque *deque) {
+    for (size_t i = 0; i < deque->blocks; i++) {
+        block_give_back(deque, block_at(deque, i));
+    }
+    deque->blocks = 0;
+    deque->map_head = 0;
+    deque->start = 0;
+}
+
+// Adds an element in front of the first one
+// returns 0 on success, -1 on failure
+int list_deque_push_front(ListDeque *deque, void *data) {
+    if (deque == NULL) return -1;
+
+    if (deque->start == 0) {
+        if (add_front_block(deque) != 0) return -1;
+        deque->start = DEQUE_BLOCK;
+    }
+    deque->start--;
+    block_at(deque, 0)->slots[deque->start] = data;
+    deque->size++;
+    return 0;
+};
+
+// Adds an element after the last one
+// returns 0 on success, -1 on failure
+int list_deque_push_back(ListDeque *deque, void *data) {
+    if (deque == NULL) return -1;
+
+    size_t position = deque->start + deque->size;
+    if (position == deque->blocks * DEQUE_BLOCK) {
+        if (add_back_block(deque) != 0) return -1;
+    }
+    block_at(deque, position / DEQUE_BLOCK)->slots[position % DEQUE_BLOCK] = data;
+    deque->size++;
+    return 0;
+};
+
+// Removes the first element and stores it in *out_data
+// returns 0 on success, -1 if the deque is empty
+int list_deque_pop_front(ListDeque *deque, void **out_data) {
+    if (deque == NULL || out_data == NULL || deque->size == 0) return -1;
+
+    *out_data = block_at(deque, 0)->slots[deque->start];
+    deque->start++;
+    deque->size--;
+
+    if (deque->size == 0) {
+        drop_all_blocks(deque);
+    } else if (deque->start == DEQUE_BLOCK) {
+        block_give_back(deque, block_at(deque, 0));
+        deque->map_head = (deque->map_head + 1) & (deque->map_capacity - 1);
+        deque->blocks--;
+        deque->start = 0;
+    }
+    return 0;
+};
+
+// Removes the last element and stores it in *out_data
+// returns 0 on success, -1 if the deque is empty
+int list_deque_pop_back(ListDeque *deque, void **out_data) {
+    if (deque == NULL || out_data == NULL || deque->size == 0) return -1;
+
+    deque->size--;
+    size_t position = deque->start + deque->size;
+    *out_data = block_at(deque, position / DEQUE_BLOCK)->slots[position % DEQUE_BLOCK];
+
+    if (deque->size == 0) {
+        drop_all_blocks(deque);
+    } else if (position % DEQUE_BLOCK == 0) {
+        // the element was the only one left in the last block
+        deque->blocks--;
+        block_give_back(deque, block_at(deque, deque->blocks));
+    }
+    return 0;
+};
+
+// Fetches the element at index (0-based, from the front) in O(1)
+// returns 0 on success, -1 on failure
+int list_deque_get_at(const ListDeque *deque, size_t index, void **out_data) {
+    if (deque == NULL || out_data == NULL || index >= deque->size) return -1;
+    size_t position = deque->start + index;
+    *out_data = block_at(deque, position / DEQUE_BLOCK)->slots[position % DEQUE_BLOCK];
+    return 0;
+};
+
+// Replaces the element at index (0-based, from the front) in O(1)
+// returns 0 on success, -1 on failure
+int list_deque_set_at(ListDeque *deque, size_t index, void *data) {
+    if (deque == NULL || index >= deque->size) return -1;
+    size_t position = deque->start + index;
+    block_at(deque, position / DEQUE_BLOCK)->slots[position % DEQUE_BLOCK] = data;
+    return 0;
+};
+
+// Returns the number of elements in the deque
+size_t list_deque_size(const ListDeque *deque) {
+    if (deque == NULL) return 0;
+    return deque->size;
+};
+
+// Frees the deque and its blocks, applying free_func (if not NULL) to every element
+void list_deque_destroy(ListDeque *deque, void (*free_func)(void *)) {
+    if (deque == NULL) return;
+
+    if (free_func != NULL) {
+        for (size_t i = 0; i < deque->size; i++) {
+            size_t position = deque->start + i;
+            free_func(block_at(deque, position / DEQUE_BLOCK)->slots[position % DEQUE_BLOCK]);
+        }
+    }
+    for (size_t i = 0; i < deque->blocks; i++) {
+        free(block_at(deque, i));
+    }
+    for (size_t i = 0; i < deque->spare_count; i++) {
+        free(deque->spare[i]);
+    }
+    free(deque->map);
+    free(deque);
+};
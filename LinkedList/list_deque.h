@@ -0,0 +1,46 @@
+#ifndef LIST_DEQUE_H
+#define LIST_DEQUE_H
+
+#include <stddef.h>
+
+// A double-ended queue of void pointers kept in fixed-size blocks.
+// Pushing and popping at either end is O(1) and only allocates when a block
+// fills up, emptied blocks are kept and reused. For FIFO use it replaces
+// list_add plus list_remove_at(list, 0, ...) without a node per element.
+typedef struct ListDeque ListDeque;
+
+// Creates an empty deque
+// returns NULL on failure
+ListDeque *list_deque_create(void);
+
+// Adds an element in front of the first one
+// returns 0 on success, -1 on failure
+int list_deque_push_front(ListDeque *deque, void *data);
+
+// Adds an element after the last one
+// returns 0 on success, -1 on failure
+int list_deque_push_back(ListDeque *deque, void *data);
+
+// Removes the first element and stores it in *out_data
+// returns 0 on success, -1 if the deque is empty
+int list_deque_pop_front(ListDeque *deque, void **out_data);
+
+// Removes the last element and stores it in *out_data
+// returns 0 on success, -1 if the deque is empty
+int list_deque_pop_back(ListDeque *deque, void **out_data);
+
+// Fetches the element at index (0-based, from the front) in O(1)
+// returns 0 on success, -1 on failure
+int list_deque_get_at(const ListDeque *deque, size_t index, void **out_data);
+
+// Replaces the element at index (0-based, from the front) in O(1)
+// returns 0 on success, -1 on failure
+int list_deque_set_at(ListDeque *deque, size_t index, void *data);
+
+// Returns the number of elements in the deque
+size_t list_deque_size(const ListDeque *deque);
+
+// Frees the deque and its blocks, applying free_func (if not NULL) to every element
+void list_deque_destroy(ListDeque *deque, void (*free_func)(void *));
+
+#endif //LIST_DEQUE_H
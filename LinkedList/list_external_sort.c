@@ -0,0 +1,561 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "linked_list.h"
+#include "linked_list_internal.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// External merge sort
+//
+// Phase one cuts the list into chunks that fit the memory budget, sorts each
+// chunk in memory and writes it out as a sorted run, handing the elements to
+// the serializer's free function as soon as they are on disk.
+// Phase two merges the runs back with a heap, as many at a time as the budget
+// allows room for read buffers, in extra passes if there are too many runs.
+
+#define RUN_BUFFER_MAX (64 * 1024)
+#define RUN_BUFFER_MIN 512
+
+// A sorted run spilled to a temporary file.
+// Runs that are not being read or written are parked as a bare file descriptor,
+// so only the runs of the current pass hold a stream buffer.
+typedef struct SortRun {
+    int fd;
+    FILE * file;
+    char * buffer;
+    size_t count;
+} SortRun;
+
+// One entry of the merge heap: the current element of a run
+typedef struct RunHeapEntry {
+    void * data;
+    size_t run;
+} RunHeapEntry;
+
+// Everything the two phases share
+typedef struct ExternalSort {
+    int (*compare)(const void *, const void *);
+    const ListSerializer * serializer;
+    const char * tmpdir;
+    size_t mem_budget;
+    // largest element seen so far, used to size the merge fan-in
+    size_t max_element;
+    SortRun * runs;
+    size_t run_count;
+    size_t run_capacity;
+} ExternalSort;
+
+// Memory an element is charged against the budget while it sits in a chunk
+static size_t element_cost(const ExternalSort *sort, const void *data) {
+    size_t cost = sizeof(LinkedListNode);
+    if (sort->serializer->mem_size != NULL) {
+        cost += sort->serializer->mem_size(data, sort->serializer->ctx);
+    }
+    return cost;
+}
+
+static void free_element(const ExternalSort *sort, void *data) {
+    if (sort->serializer->free_func != NULL) {
+        sort->serializer->free_func(data);
+    }
+}
+
+// Opens an anonymous temporary file, inside tmpdir when one is given.
+// The file is unlinked right away so nothing is left behind on failure.
+static FILE *open_temp_file(const char *tmpdir) {
+#ifndef _WIN32
+    if (tmpdir != NULL) {
+        const char * name = "/listsortXXXXXX";
+        size_t length = strlen(tmpdir);
+        char * path = malloc(length + strlen(name) + 1);
+        if (path == NULL) return NULL;
+        memcpy(path, tmpdir, length);
+        strcpy(path + length, name);
+
+        int fd = mkstemp(path);
+        if (fd < 0) {
+            free(path);
+            return NULL;
+        }
+        unlink(path);
+        free(path);
+
+        FILE * file = fdopen(fd, "w+b");
+        if (file == NULL) close(fd);
+        return file;
+    }
+#else
+    (void)tmpdir;
+#endif
+    return tmpfile();
+}
+
+// Gives a freshly opened stream a buffer of buffer_size bytes,
+// this has to happen before anything is read or written
+// returns 0 on success, -1 on failure
+static int set_run_buffer(SortRun *run, size_t buffer_size) {
+    run->buffer = malloc(buffer_size);
+    if (run->buffer == NULL) return -1;
+    return setvbuf(run->file, run->buffer, _IOFBF, buffer_size) == 0 ? 0 : -1;
+}
+
+// Flushes a run and closes its stream but keeps the file open through a
+// duplicate descriptor, which also lets go of the stream buffer
+// returns 0 on success, -1 on failure
+static int park_run(SortRun *run) {
+    if (fflush(run->file) != 0) return -1;
+    run->fd = dup(fileno(run->file));
+    fclose(run->file);
+    free(run->buffer);
+    run->file = NULL;
+    run->buffer = NULL;
+    return run->fd < 0 ? -1 : 0;
+}
+
+// Opens a stream on a parked run, positioned at its start
+// returns 0 on success, -1 on failure
+static int resume_run(SortRun *run, size_t buffer_size) {
+    if (lseek(run->fd, 0, SEEK_SET) != 0) return -1;
+    run->file = fdopen(run->fd, "rb");
+    if (run->file == NULL) return -1;
+    // the stream owns the descriptor from here on
+    run->fd = -1;
+    return set_run_buffer(run, buffer_size);
+}
+
+static void close_run(SortRun *run) {
+    if (run->file != NULL) {
+        fclose(run->file);
+    } else if (run->fd >= 0) {
+        close(run->fd);
+    }
+    free(run->buffer);
+    run->fd = -1;
+    run->file = NULL;
+    run->buffer = NULL;
+}
+
+// Adds an empty run backed by a fresh temporary file, open for writing
+// returns the new run or NULL on failure
+static SortRun *new_run(ExternalSort *sort, size_t buffer_size) {
+    if (sort->run_count == sort->run_capacity) {
+        size_t capacity = sort->run_capacity == 0 ? 16 : sort->run_capacity * 2;
+        SortRun * runs = realloc(sort->runs, capacity * sizeof(SortRun));
+        if (runs == NULL) return NULL;
+        sort->runs = runs;
+        sort->run_capacity = capacity;
+    }
+
+    SortRun * run = &sort->runs[sort->run_count];
+    run->fd = -1;
+    run->file = open_temp_file(sort->tmpdir);
+    run->buffer = NULL;
+    run->count = 0;
+    if (run->file == NULL) return NULL;
+    if (set_run_buffer(run, buffer_size) != 0) {
+        close_run(run);
+        return NULL;
+    }
+    sort->run_count++;
+    return run;
+}
+
+// Sorts a detached chunk and writes it to run. Only once the whole run is out
+// are the nodes freed and the elements handed to the free function; on failure
+// nothing is freed and *chunk is left holding the sorted chunk.
+// returns 0 on success, -1 on failure
+static int spill_chunk(ExternalSort *sort, LinkedList *list, SortRun *run, LinkedListNode **chunk) {
+    *chunk = merge_sort_nodes(*chunk, sort->compare);
+
+    for (LinkedListNode * node = *chunk; node != NULL; node = node->next) {
+        if (sort->serializer->write(node->data, run->file, sort->serializer->ctx) != 0) return -1;
+        run->count++;
+    }
+    if (park_run(run) != 0) return -1;
+
+    while (*chunk != NULL) {
+        LinkedListNode * to_delete = *chunk;
+        *chunk = to_delete->next;
+        free_element(sort, to_delete->data);
+        list_node_release(list, to_delete);
+    }
+    return 0;
+}
+
+// Returns the last node of the chunk that starts at node: as many nodes as fit
+// in budget, and always at least one, or the sort would never move on
+static LinkedListNode *chunk_end(const ExternalSort *sort, LinkedListNode *node, size_t budget) {
+    size_t used = element_cost(sort, node->data);
+    while (node->next != NULL) {
+        size_t cost = element_cost(sort, node->next->data);
+        if (used + cost > budget) break;
+        used += cost;
+        node = node->next;
+    }
+    return node;
+}
+
+// Moves the entry at index down until the heap property holds again.
+// Ties go to the lower run, and runs are always kept in list order, so the sort stays stable.
+static void run_heap_sift_down(RunHeapEntry *heap, size_t count, size_t index,
+                               int (*compare)(const void *, const void *)) {
+    RunHeapEntry entry = heap[index];
+    for (;;) {
+        size_t child = 2 * index + 1;
+        if (child >= count) break;
+        if (child + 1 < count) {
+            int order = compare(heap[child + 1].data, heap[child].data);
+            if (order < 0 || (order == 0 && heap[child + 1].run < heap[child].run)) {
+                child++;
+            }
+        }
+        int order = compare(heap[child].data, entry.data);
+        if (order > 0 || (order == 0 && heap[child].run > entry.run)) break;
+        heap[index] = heap[child];
+        index = child;
+    }
+    heap[index] = entry;
+}
+
+// Reads the next element of a run into a heap entry
+// returns 1 when an element was read, 0 when the run is used up, -1 on failure
+static int read_run(ExternalSort *sort, SortRun *run, RunHeapEntry *entry) {
+    if (run->count == 0) return 0;
+    entry->data = sort->serializer->read(run->file, sort->serializer->ctx);
+    if (entry->data == NULL) return -1;
+    run->count--;
+    return 1;
+}
+
+static void append_node(LinkedList *list, LinkedListNode *node) {
+    node->next = NULL;
+    if (list->head == NULL) {
+        list->head = node;
+    } else {
+        list->tail->next = node;
+    }
+    list->tail = node;
+    list->size++;
+}
+
+// Puts everything a failed spill took out of the list back into it: the elements
+// of the runs written so far, read back from disk, then the nodes of chunk and rest
+// returns 0 if every element is back, -1 if some could not be read back
+static int restore_spill(ExternalSort *sort, LinkedList *list, LinkedListNode *chunk, LinkedListNode *rest) {
+    int result = 0;
+    for (size_t i = 0; i < sort->run_count; i++) {
+        SortRun * run = &sort->runs[i];
+        if (resume_run(run, RUN_BUFFER_MIN) != 0) {
+            result = -1;
+            continue;
+        }
+        RunHeapEntry entry;
+        int status;
+        while ((status = read_run(sort, run, &entry)) > 0) {
+            LinkedListNode * node = list_node_alloc(list);
+            if (node == NULL) {
+                free_element(sort, entry.data);
+                result = -1;
+                continue;
+            }
+            node->data = entry.data;
+            append_node(list, node);
+        }
+        if (status < 0) result = -1;
+    }
+
+    LinkedListNode * nodes[2] = {chunk, rest};
+    for (size_t i = 0; i < 2; i++) {
+        while (nodes[i] != NULL) {
+            LinkedListNode * node = nodes[i];
+            nodes[i] = node->next;
+            append_node(list, node);
+        }
+    }
+    // never more elements than the index held before the sort, so it has room for them
+    list_index_rebuild(list);
+    list_handle_relink(list, list->size);
+    return result;
+}
+
+// Merges runs [first, first + count) and passes every element, in order, to emit.
+// emit returns 0 to keep going, in which case it took ownership of the element.
+// returns 0 on success, -1 on failure
+static int merge_runs(ExternalSort *sort, size_t first, size_t count, size_t buffer_size,
+                      int (*emit)(void *data, void *ctx), void *emit_ctx) {
+    RunHeapEntry * heap = malloc(count * sizeof(RunHeapEntry));
+    if (heap == NULL) return -1;
+
+    int result = 0;
+    size_t live = 0;
+    for (size_t i = 0; i < count && result == 0; i++) {
+        SortRun * run = &sort->runs[first + i];
+        if (resume_run(run, buffer_size) != 0) {
+            result = -1;
+            break;
+        }
+        heap[live].run = first + i;
+        int status = read_run(sort, run, &heap[live]);
+        if (status < 0) result = -1;
+        if (status > 0) live++;
+    }
+    for (size_t i = live / 2; i-- > 0;) {
+        run_heap_sift_down(heap, live, i, sort->compare);
+    }
+
+    while (live > 0 && result == 0) {
+        void * smallest = heap[0].data;
+        int status = read_run(sort, &sort->runs[heap[0].run], &heap[0]);
+        if (status < 0) {
+            heap[0].data = smallest;
+            result = -1;
+            break;
+        }
+        if (status == 0) {
+            heap[0] = heap[--live];
+        }
+        if (live > 0) {
+            run_heap_sift_down(heap, live, 0, sort->compare);
+        }
+        if (emit(smallest, emit_ctx) != 0) {
+            free_element(sort, smallest);
+            result = -1;
+        }
+    }
+
+    // on failure the elements still waiting in the heap are not going anywhere
+    for (size_t i = 0; i < live; i++) {
+        free_element(sort, heap[i].data);
+    }
+    free(heap);
+    for (size_t i = 0; i < count; i++) {
+        close_run(&sort->runs[first + i]);
+    }
+    return result;
+}
+
+// emit callback for intermediate passes: writes the element to the output run
+typedef struct RunWriter {
+    ExternalSort * sort;
+    SortRun * run;
+} RunWriter;
+
+static int emit_to_run(void *data, void *ctx) {
+    RunWriter * writer = ctx;
+    if (writer->sort->serializer->write(data, writer->run->file, writer->sort->serializer->ctx) != 0) return -1;
+    free_element(writer->sort, data);
+    writer->run->count++;
+    return 0;
+}
+
+// emit callback for the last pass when the result goes back into the list
+static int emit_to_list(void *data, void *ctx) {
+    if (list_add_unrecorded(ctx, data) != 0) return -1;
+    return 0;
+}
+
+// emit callback for the last pass when the result goes to a user sink
+typedef struct SinkTarget {
+    int (*sink)(void *data, void *ctx);
+    void * ctx;
+} SinkTarget;
+
+static int emit_to_sink(void *data, void *ctx) {
+    SinkTarget * target = ctx;
+    return target->sink(data, target->ctx) == 0 ? 0 : -1;
+}
+
+// Works out how many runs one merge pass can read at once and how big their
+// buffers can be: every input run needs a read buffer plus one element in the
+// heap, and intermediate passes also need a write buffer for the output run.
+// returns the fan-in, 0 if the budget cannot fit even a two-way merge
+static size_t merge_fan_in(const ExternalSort *sort, size_t *out_buffer_size) {
+    size_t per_run_extra = sort->max_element + sizeof(RunHeapEntry) + sizeof(SortRun);
+    size_t fan_in = 0;
+
+    // prefer big buffers, but shrink them rather than pay for an extra merge pass
+    for (size_t buffer_size = RUN_BUFFER_MAX; buffer_size >= RUN_BUFFER_MIN; buffer_size /= 2) {
+        if (sort->mem_budget <= buffer_size) continue;
+        size_t runs = (sort->mem_budget - buffer_size) / (buffer_size + per_run_extra);
+        if (runs < 2) continue;
+        fan_in = runs;
+        *out_buffer_size = buffer_size;
+        if (fan_in >= sort->run_count) break;
+    }
+    return fan_in;
+}
+
+// Frees everything still held by the runs, used on failure
+static void discard_runs(ExternalSort *sort) {
+    for (size_t i = 0; i < sort->run_count; i++) {
+        close_run(&sort->runs[i]);
+    }
+    free(sort->runs);
+    sort->runs = NULL;
+    sort->run_count = 0;
+}
+
+// Shared body of list_external_sort and list_external_sort_to
+static int external_sort(LinkedList *list, int (*compare)(const void *, const void *),
+                         const ListSerializer *serializer, size_t mem_budget, const char *tmpdir,
+                         int (*sink)(void *data, void *ctx), void *sink_ctx) {
+    if (list == NULL || compare == NULL || serializer == NULL ||
+        serializer->write == NULL || serializer->read == NULL || list_make_private(list) != 0) return -1;
+
+    ExternalSort sort = {compare, serializer, tmpdir, mem_budget, 0, NULL, 0, 0};
+
+    // the write buffer of the run being spilled comes out of the budget too
+    size_t spill_buffer = RUN_BUFFER_MAX;
+    while (spill_buffer > RUN_BUFFER_MIN && spill_buffer * 4 > mem_budget) {
+        spill_buffer /= 2;
+    }
+    if (mem_budget <= spill_buffer + sizeof(LinkedListNode)) return -1;
+    size_t chunk_budget = mem_budget - spill_buffer;
+    if (list->head == NULL) return 0;
+
+    // everything fits in one chunk, no need to touch the disk at all
+    LinkedListNode * chunk_tail = chunk_end(&sort, list->head, chunk_budget);
+    if (chunk_tail->next == NULL) {
+        list_merge_sort_unrecorded(list, compare);
+        if (sink == NULL) return 0;
+
+        // hand the sorted elements over to the sink one at a time
+        int result = 0;
+        while (list->head != NULL) {
+            LinkedListNode * node = list->head;
+            void * data = node->data;
+            list->head = node->next;
+            list->size--;
+            list_index_erase(list, node);
+            list_node_release(list, node);
+            if (result == 0 && sink(data, sink_ctx) != 0) result = -1;
+            if (result != 0) free_element(&sort, data);
+        }
+        list->tail = NULL;
+        return result;
+    }
+
+    // Everything that can fail before the first element is spilled is checked
+    // up front, so the list is untouched when it does: the merge needs the size
+    // of the largest element, and the first run has to open in tmpdir
+    for (LinkedListNode * node = list->head; node != NULL; node = node->next) {
+        size_t cost = element_cost(&sort, node->data);
+        if (cost > sort.max_element) sort.max_element = cost;
+    }
+    size_t buffer_size = 0;
+    if (merge_fan_in(&sort, &buffer_size) < 2) return -1;
+    // nodes kept in the header have no slot to go back to once they are detached
+    if (list_spill_inline(list) != 0) return -1;
+    SortRun * run = new_run(&sort, spill_buffer);
+    if (run == NULL) {
+        discard_runs(&sort);
+        return -1;
+    }
+
+    // Phase one: cut the chain into chunks that fit and spill the sorted runs
+    LinkedListNode * chunk = list->head;
+    LinkedListNode * cursor = chunk_tail->next;
+    chunk_tail->next = NULL;
+    list->head = NULL;
+    list->tail = NULL;
+    list->size = 0;
+    list_index_rebuild(list);
+
+    for (;;) {
+        if (run == NULL) run = new_run(&sort, spill_buffer);
+        if (run == NULL) break;
+        if (spill_chunk(&sort, list, run, &chunk) != 0) {
+            // a run that did not make it out is of no use to anyone
+            close_run(run);
+            sort.run_count--;
+            break;
+        }
+        run = NULL;
+        if (cursor == NULL) break;
+
+        chunk = cursor;
+        chunk_tail = chunk_end(&sort, chunk, chunk_budget);
+        cursor = chunk_tail->next;
+        chunk_tail->next = NULL;
+    }
+    if (chunk != NULL) {
+        restore_spill(&sort, list, chunk, cursor);
+        discard_runs(&sort);
+        return -1;
+    }
+
+    // Phase two: merge runs until few enough are left for one final pass
+    size_t fan_in = merge_fan_in(&sort, &buffer_size);
+    int result = 0;
+
+    // every pass merges neighbouring groups of runs, and the merged run takes
+    // the slot of the group, so runs stay in list order from pass to pass
+    while (result == 0 && sort.run_count > fan_in) {
+        size_t groups = 0;
+        for (size_t first = 0; first < sort.run_count; first += fan_in) {
+            size_t count = sort.run_count - first < fan_in ? sort.run_count - first : fan_in;
+            if (count > 1) {
+                // new_run may move the array, so refer to the output run by index
+                if (new_run(&sort, buffer_size) == NULL) {
+                    result = -1;
+                    break;
+                }
+                RunWriter writer = {&sort, &sort.runs[sort.run_count - 1]};
+                result = merge_runs(&sort, first, count, buffer_size, emit_to_run, &writer);
+                if (result == 0) result = park_run(writer.run);
+                sort.run_count--;
+                if (result != 0) {
+                    close_run(writer.run);
+                    break;
+                }
+                sort.runs[groups] = *writer.run;
+            } else if (groups != first) {
+                sort.runs[groups] = sort.runs[first];
+                sort.runs[first].fd = -1;
+            }
+            groups++;
+        }
+        // after a failure the slots past groups are a mix of closed and untouched runs,
+        // closing them again is harmless so discard_runs can take care of all of them
+        if (result == 0) sort.run_count = groups;
+    }
+
+    if (result == 0) {
+        if (sink == NULL) {
+            result = merge_runs(&sort, 0, sort.run_count, buffer_size, emit_to_list, list);
+        } else {
+            SinkTarget target = {sink, sink_ctx};
+            result = merge_runs(&sort, 0, sort.run_count, buffer_size, emit_to_sink, &target);
+        }
+    }
+
+    discard_runs(&sort);
+    return result;
+}
+
+// Sorts a list that may not fit in memory with an external merge sort.
+// Chunks that fit in mem_budget bytes are sorted and spilled to temporary
+// files in tmpdir (NULL for the system default), then merged back into the list.
+// returns 0 on success, -1 on failure
+int list_external_sort(LinkedList *list, int (*compare)(const void *, const void *),
+                       const ListSerializer *serializer, size_t mem_budget, const char *tmpdir) {
+    return external_sort(list, compare, serializer, mem_budget, tmpdir, NULL, NULL);
+};
+
+// Same as list_external_sort but streams the sorted elements to sink instead
+// of putting them back into the list, which is left empty.
+// returns 0 on success, -1 on failure
+int list_external_sort_to(LinkedList *list, int (*compare)(const void *, const void *),
+                          const ListSerializer *serializer, size_t mem_budget, const char *tmpdir,
+                          int (*sink)(void *data, void *ctx), void *sink_ctx) {
+    if (sink == NULL) return -1;
+    return external_sort(list, compare, serializer, mem_budget, tmpdir, sink, sink_ctx);
+};
@@ -0,0 +1,265 @@
+#include "linked_list.h"
+#include "linked_list_internal.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Node handles
+//
+// A handle names a slot in a table the list keeps, and the slot points at the
+// node. Every slot carries a generation that goes up whenever its node leaves
+// the list, and a handle remembers the generation it was made with, so a handle
+// to a removed element is recognised as stale instead of touching freed memory.
+// The slot also remembers the node in front of its node, which is what lets a
+// singly linked list remove or insert at a handle in O(1). Operations that touch
+// a single link keep that up to date, the ones that relink many nodes at once
+// walk the list once at the end to set it again.
+
+#define HANDLE_MIN_CAPACITY 16
+#define HANDLE_NO_SLOT UINT32_MAX
+
+typedef struct HandleEntry {
+    // NULL when the slot is free
+    LinkedListNode * node;
+    // node in front of node, NULL when node is the head
+    LinkedListNode * prev;
+    uint32_t generation;
+    // next free slot, while this one is free
+    uint32_t next_free;
+} HandleEntry;
+
+struct ListHandles {
+    HandleEntry * entries;
+    uint32_t capacity;
+    uint32_t free_head;
+};
+
+// Handles are (generation << 32) | (slot + 1), so 0 is never a valid one
+static ListHandle make_handle(uint32_t slot, uint32_t generation) {
+    return ((ListHandle)generation << 32) | ((ListHandle)slot + 1);
+}
+
+// Looks a handle up
+// returns its entry, NULL if the handle is stale or was never valid for this list
+static HandleEntry *resolve(const LinkedList *list, ListHandle handle) {
+    ListHandles * handles = list->handles;
+    uint32_t slot = (uint32_t)(handle & 0xffffffffu);
+    if (handles == NULL || slot == 0 || slot > handles->capacity) return NULL;
+
+    HandleEntry * entry = &handles->entries[slot - 1];
+    if (entry->node == NULL || entry->generation != (uint32_t)(handle >> 32)) return NULL;
+    return entry;
+}
+
+// Makes sure the list can hand out one more handle without allocating
+// returns 0 on success, -1 on failure
+int list_handle_reserve(LinkedList *list) {
+    // lists in an arena take their table from it too, so resetting the arena frees it
+    ListHandles * handles = list->handles;
+    if (handles == NULL) {
+        if (list->arena != NULL) {
+            handles = list_arena_alloc(list->arena, sizeof(ListHandles));
+        } else {
+            handles = malloc(sizeof(ListHandles));
+        }
+        if (handles == NULL) return -1;
+        handles->entries = NULL;
+        handles->capacity = 0;
+        handles->free_head = HANDLE_NO_SLOT;
+        list->handles = handles;
+    }
+    if (handles->free_head != HANDLE_NO_SLOT) return 0;
+
+    uint32_t capacity = handles->capacity == 0 ? HANDLE_MIN_CAPACITY : handles->capacity * 2;
+    if (capacity <= handles->capacity || capacity == HANDLE_NO_SLOT) return -1;
+    HandleEntry * entries;
+    if (list->arena != NULL) {
+        // the old entries stay behind in the arena until it is reset
+        entries = list_arena_alloc(list->arena, capacity * sizeof(HandleEntry));
+        if (entries == NULL) return -1;
+        if (handles->capacity > 0) memcpy(entries, handles->entries, handles->capacity * sizeof(HandleEntry));
+    } else {
+        entries = realloc(handles->entries, capacity * sizeof(HandleEntry));
+        if (entries == NULL) return -1;
+    }
+
+    // chain the new slots onto the free list in order
+    for (uint32_t i = handles->capacity; i < capacity; i++) {
+        entries[i].node = NULL;
+        entries[i].prev = NULL;
+        entries[i].generation = 0;
+        entries[i].next_free = i + 1 < capacity ? i + 1 : HANDLE_NO_SLOT;
+    }
+    handles->free_head = handles->capacity;
+    handles->entries = entries;
+    handles->capacity = capacity;
+    return 0;
+}
+
+// Gives node, which sits right after prev (NULL for the head), a handle.
+// list_handle_reserve must have succeeded first. A node keeps a single handle,
+// asking again returns the one it has.
+ListHandle list_handle_assign(LinkedList *list, LinkedListNode *node, LinkedListNode *prev) {
+    ListHandles * handles = list->handles;
+    if (node->handle != 0) {
+        HandleEntry * entry = &handles->entries[node->handle - 1];
+        entry->prev = prev;
+        return make_handle(node->handle - 1, entry->generation);
+    }
+
+    uint32_t slot = handles->free_head;
+    HandleEntry * entry = &handles->entries[slot];
+    handles->free_head = entry->next_free;
+    entry->node = node;
+    entry->prev = prev;
+    node->handle = slot + 1;
+    return make_handle(slot, entry->generation);
+}
+
+// Records that node, if it has a handle, now sits right after prev (NULL for the head)
+void list_handle_set_prev(LinkedList *list, LinkedListNode *node, LinkedListNode *prev) {
+    if (list->handles == NULL || node == NULL || node->handle == 0) return;
+    list->handles->entries[node->handle - 1].prev = prev;
+}
+
+// Makes the handle of a node that leaves the list stale
+void list_handle_forget(LinkedList *list, LinkedListNode *node) {
+    ListHandles * handles = list->handles;
+    if (handles == NULL || node->handle == 0) return;
+
+    uint32_t slot = node->handle - 1;
+    HandleEntry * entry = &handles->entries[slot];
+    entry->node = NULL;
+    entry->prev = NULL;
+    entry->generation++;
+    entry->next_free = handles->free_head;
+    handles->free_head = slot;
+    node->handle = 0;
+}
+
+// Moves the handle of old_node over to new_node, which replaces it in the list
+void list_handle_replace(LinkedList *list, LinkedListNode *old_node, LinkedListNode *new_node) {
+    if (list->handles == NULL || old_node->handle == 0) return;
+    list->handles->entries[old_node->handle - 1].node = new_node;
+    new_node->handle = old_node->handle;
+    old_node->handle = 0;
+}
+
+// Points the handles of the first count nodes, and of the one after them, at the
+// nodes now in front of them, for operations that relink more than one link at once
+void list_handle_relink(LinkedList *list, size_t count) {
+    if (list->handles == NULL) return;
+
+    LinkedListNode * prev = NULL;
+    LinkedListNode * cursor = list->head;
+    for (size_t i = 0; i <= count && i < list->size; i++) {
+        list_handle_set_prev(list, cursor, prev);
+        prev = cursor;
+        cursor = cursor->next;
+    }
+}
+
+// Makes every handle of the list stale, for when all of its nodes move to another list
+void list_handle_clear(LinkedList *list) {
+    ListHandles * handles = list->handles;
+    if (handles == NULL) return;
+    for (uint32_t slot = 0; slot < handles->capacity; slot++) {
+        if (handles->entries[slot].node != NULL) {
+            list_handle_forget(list, handles->entries[slot].node);
+        }
+    }
+}
+
+// Frees the handle table of a list
+void list_handle_free(LinkedList *list) {
+    if (list->handles == NULL) return;
+    // a table taken from an arena goes with the arena
+    if (list->arena == NULL) {
+        free(list->handles->entries);
+        free(list->handles);
+    }
+    list->handles = NULL;
+}
+
+// Gets a handle to the element at index, walking to it once
+// returns 0 on success, -1 on failure
+int list_handle_at(LinkedList *list, size_t index, ListHandle *out_handle) {
+    if (list == NULL || list->read_only || out_handle == NULL || index >= list->size) return -1;
+    if (list_handle_reserve(list) != 0) return -1;
+
+    LinkedListNode * prev = NULL;
+    LinkedListNode * cursor = list->head;
+    for (size_t i = 0; i < index; i++) {
+        prev = cursor;
+        cursor = cursor->next;
+    }
+    *out_handle = list_handle_assign(list, cursor, prev);
+    return 0;
+};
+
+// Fetches the element a handle refers to in O(1)
+// returns 0 on success, -1 if the handle is stale or not from this list
+int list_get_handle(LinkedList *list, ListHandle handle, void **out_data) {
+    if (list == NULL || out_data == NULL) return -1;
+    HandleEntry * entry = resolve(list, handle);
+    if (entry == NULL) return -1;
+    *out_data = entry->node->data;
+    return 0;
+};
+
+// Removes the element a handle refers to in O(1) and stores it in *out_data
+// (out_data may be NULL). The handle is stale afterwards.
+// returns 0 on success, -1 if the handle is stale or not from this list
+int list_remove_handle(LinkedList *list, ListHandle handle, void **out_data) {
+    if (list == NULL || list->read_only || resolve(list, handle) == NULL) return -1;
+    // the node in front gets a new next pointer, so nothing may be shared
+    if (list_make_private(list) != 0) return -1;
+
+    HandleEntry * entry = resolve(list, handle);
+    LinkedListNode * node = entry->node;
+    LinkedListNode * prev = entry->prev;
+
+    if (prev == NULL) {
+        list->head = node->next;
+    } else {
+        prev->next = node->next;
+    }
+    if (list->tail == node) list->tail = prev;
+    list_handle_set_prev(list, node->next, prev);
+    list->size--;
+
+    if (out_data != NULL) *out_data = node->data;
+    list_index_erase(list, node);
+    list_node_release(list, node);
+    return 0;
+};
+
+// Inserts data right after the element a handle refers to in O(1), and stores a
+// handle to the new element in *out_handle (out_handle may be NULL)
+// returns 0 on success, -1 if the handle is stale or not from this list, or on failure
+int list_insert_after_handle(LinkedList *list, ListHandle handle, void *data, ListHandle *out_handle) {
+    if (list == NULL || list->read_only || resolve(list, handle) == NULL) return -1;
+    // the node at the handle gets a new next pointer, so nothing may be shared
+    if (list_make_private(list) != 0) return -1;
+    if (out_handle != NULL && list_handle_reserve(list) != 0) return -1;
+
+    LinkedListNode * new_node = list_node_alloc(list);
+    if (new_node == NULL) return -1;
+    new_node->data = data;
+    if (list_index_insert(list, new_node) != 0) {
+        list_node_release(list, new_node);
+        return -1;
+    }
+
+    // taking the node may have moved a small list out of its header, so look the handle up now
+    LinkedListNode * node = resolve(list, handle)->node;
+    new_node->next = node->next;
+    node->next = new_node;
+    if (list->tail == node) list->tail = new_node;
+    list_handle_set_prev(list, new_node->next, new_node);
+    list->size++;
+
+    if (out_handle != NULL) *out_handle = list_handle_assign(list, new_node, node);
+    return 0;
+};
@@ -0,0 +1,138 @@
+#include "linked_list.h"
+#include "linked_list_internal.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Open addressing hash table
+//
+// Linear probing over a power of two number of slots, kept at most three
+// quarters full. Every slot remembers the full hash of its item so probing
+// rarely has to look at the item itself, and deletions shift later entries
+// back instead of leaving tombstones, so lookups stay short no matter how much
+// the table churns. The hash index of a list and the LRU cache both sit on it.
+
+#define HASH_TABLE_MIN_CAPACITY 16
+
+// Capacity needed to hold count items while staying at most three quarters full
+static size_t capacity_for(size_t count) {
+    size_t capacity = HASH_TABLE_MIN_CAPACITY;
+    while (capacity - capacity / 4 < count) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+// Gets capacity empty slots, from the arena of the table when it has one
+// returns NULL on failure
+static ListHashSlot *alloc_slots(const ListHashTable *table, size_t capacity) {
+    if (table->arena == NULL) return calloc(capacity, sizeof(ListHashSlot));
+    ListHashSlot * slots = list_arena_alloc(table->arena, capacity * sizeof(ListHashSlot));
+    if (slots != NULL) memset(slots, 0, capacity * sizeof(ListHashSlot));
+    return slots;
+}
+
+// Gives slots back, arena slots are only reclaimed by resetting the arena
+static void free_slots(const ListHashTable *table, ListHashSlot *slots) {
+    if (table->arena == NULL) free(slots);
+}
+
+// Sets up an empty table with room for count items, whose slots come from arena
+// (NULL for malloc)
+// returns 0 on success, -1 on failure
+int list_hash_table_init(ListHashTable *table, size_t count, ListArena *arena) {
+    table->arena = arena;
+    table->capacity = capacity_for(count);
+    table->count = 0;
+    table->slots = alloc_slots(table, table->capacity);
+    return table->slots == NULL ? -1 : 0;
+}
+
+// Frees the slots of a table
+void list_hash_table_free(ListHashTable *table) {
+    free_slots(table, table->slots);
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
+
+// Places an item in the table, which must have room for it
+void list_hash_table_put(ListHashTable *table, void *item, size_t hash) {
+    size_t mask = table->capacity - 1;
+    size_t slot = hash & mask;
+    while (table->slots[slot].item != NULL) {
+        slot = (slot + 1) & mask;
+    }
+    table->slots[slot].item = item;
+    table->slots[slot].hash = hash;
+    table->count++;
+}
+
+// Makes sure count more items fit without the table having to grow
+// returns 0 on success, -1 on failure
+int list_hash_table_reserve(ListHashTable *table, size_t count) {
+    size_t capacity = capacity_for(table->count + count);
+    if (capacity <= table->capacity) return 0;
+
+    ListHashSlot * slots = alloc_slots(table, capacity);
+    if (slots == NULL) return -1;
+
+    ListHashSlot * old_slots = table->slots;
+    size_t old_capacity = table->capacity;
+    table->slots = slots;
+    table->capacity = capacity;
+    table->count = 0;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i].item != NULL) {
+            list_hash_table_put(table, old_slots[i].item, old_slots[i].hash);
+        }
+    }
+    free_slots(table, old_slots);
+    return 0;
+}
+
+// Finds the slot of an item with the given hash that matches(item, key, ctx) accepts
+// returns LIST_HASH_NO_SLOT if there is none
+size_t list_hash_table_find(const ListHashTable *table, size_t hash,
+                            int (*matches)(const void *item, const void *key, const void *ctx),
+                            const void *key, const void *ctx) {
+    size_t mask = table->capacity - 1;
+    for (size_t slot = hash & mask; table->slots[slot].item != NULL; slot = (slot + 1) & mask) {
+        if (table->slots[slot].hash == hash && matches(table->slots[slot].item, key, ctx)) return slot;
+    }
+    return LIST_HASH_NO_SLOT;
+}
+
+// Finds the slot holding item itself, which was put with hash
+// returns LIST_HASH_NO_SLOT if the item is not in the table
+size_t list_hash_table_find_item(const ListHashTable *table, const void *item, size_t hash) {
+    size_t mask = table->capacity - 1;
+    for (size_t slot = hash & mask; table->slots[slot].item != NULL; slot = (slot + 1) & mask) {
+        if (table->slots[slot].item == item) return slot;
+    }
+    return LIST_HASH_NO_SLOT;
+}
+
+// Empties a slot, pulling later entries of the probe run back into the hole
+// as long as that does not move them in front of their home slot
+void list_hash_table_erase(ListHashTable *table, size_t slot) {
+    size_t mask = table->capacity - 1;
+    size_t hole = slot;
+    size_t next = (hole + 1) & mask;
+    while (table->slots[next].item != NULL) {
+        size_t home = table->slots[next].hash & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            table->slots[hole] = table->slots[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    table->slots[hole].item = NULL;
+    table->count--;
+}
+
+// Empties the table without giving up its capacity
+void list_hash_table_clear(ListHashTable *table) {
+    memset(table->slots, 0, table->capacity * sizeof(ListHashSlot));
+    table->count = 0;
+}
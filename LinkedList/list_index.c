@@ -0,0 +1,128 @@
+#include "linked_list.h"
+#include "linked_list_internal.h"
+#include <stddef.h>
+#include <stdlib.h>
+
+// Hash index
+//
+// Maps element values to the nodes holding them through the shared open
+// addressing table (see list_hash_table.c), whose items are the nodes.
+
+struct ListIndex {
+    size_t (*hash)(const void *data);
+    int (*equals)(const void *a, const void *b);
+    ListHashTable table;
+};
+
+// Tells whether the node item holds an element equal to key, for list_hash_table_find
+static int node_matches(const void *item, const void *key, const void *ctx) {
+    const ListIndex * index = ctx;
+    return index->equals(((const LinkedListNode *)item)->data, key);
+}
+
+// Makes sure count more nodes can be indexed without the table having to grow
+// returns 0 on success (or when the list has no index), -1 on failure
+int list_index_reserve(LinkedList *list, size_t count) {
+    if (list->index == NULL) return 0;
+    return list_hash_table_reserve(&list->index->table, count);
+}
+
+// Adds a node to the index of its list
+// returns 0 on success (or when the list has no index), -1 on failure
+int list_index_insert(LinkedList *list, LinkedListNode *node) {
+    ListIndex * index = list->index;
+    if (index == NULL) return 0;
+    if (list_hash_table_reserve(&index->table, 1) != 0) return -1;
+    list_hash_table_put(&index->table, node, index->hash(node->data));
+    return 0;
+}
+
+// Removes a node from the index of its list
+void list_index_erase(LinkedList *list, LinkedListNode *node) {
+    ListIndex * index = list->index;
+    if (index == NULL) return;
+    size_t slot = list_hash_table_find_item(&index->table, node, index->hash(node->data));
+    if (slot != LIST_HASH_NO_SLOT) list_hash_table_erase(&index->table, slot);
+}
+
+// Points the index entry of old_node at new_node, which holds the same data
+void list_index_replace(LinkedList *list, LinkedListNode *old_node, LinkedListNode *new_node) {
+    ListIndex * index = list->index;
+    if (index == NULL) return;
+    size_t slot = list_hash_table_find_item(&index->table, old_node, index->hash(old_node->data));
+    if (slot != LIST_HASH_NO_SLOT) index->table.slots[slot].item = new_node;
+}
+
+// Indexes the list again from scratch, for operations that move many nodes at once.
+// Call list_index_reserve first if the list may have grown.
+void list_index_rebuild(LinkedList *list) {
+    ListIndex * index = list->index;
+    if (index == NULL) return;
+
+    list_hash_table_clear(&index->table);
+    for (LinkedListNode * cursor = list->head; cursor != NULL; cursor = cursor->next) {
+        list_hash_table_put(&index->table, cursor, index->hash(cursor->data));
+    }
+}
+
+// Frees the index of a list, one taken from an arena goes with the arena
+void list_index_free(LinkedList *list) {
+    if (list->index == NULL) return;
+    list_hash_table_free(&list->index->table);
+    if (list->arena == NULL) free(list->index);
+    list->index = NULL;
+}
+
+// Starts keeping a hash index of the list, built from its current contents.
+// hash and equals work on the stored data. Equal elements must hash the same.
+// returns 0 on success, -1 on failure
+int list_index_enable(LinkedList *list, size_t (*hash)(const void *data),
+                      int (*equals)(const void *a, const void *b)) {
+    if (list == NULL || list->read_only || hash == NULL || equals == NULL) return -1;
+
+    // lists in an arena take their index from it too, so resetting the arena frees it
+    ListIndex * index;
+    if (list->arena != NULL) {
+        index = list_arena_alloc(list->arena, sizeof(ListIndex));
+    } else {
+        index = malloc(sizeof(ListIndex));
+    }
+    if (index == NULL) return -1;
+    index->hash = hash;
+    index->equals = equals;
+    if (list_hash_table_init(&index->table, list->size, list->arena) != 0) {
+        if (list->arena == NULL) free(index);
+        return -1;
+    }
+
+    list_index_free(list);
+    list->index = index;
+    list_index_rebuild(list);
+    return 0;
+};
+
+// Stops keeping a hash index of the list and frees it
+void list_index_disable(LinkedList *list) {
+    if (list == NULL) return;
+    list_index_free(list);
+};
+
+// Looks up an element equal to key through the hash index in expected O(1)
+// returns 0 and stores the element in *out_data if found,
+// -1 if not found or if the list has no index
+int list_find(LinkedList *list, const void *key, void **out_data) {
+    if (list == NULL || list->index == NULL || out_data == NULL) return -1;
+
+    ListIndex * index = list->index;
+    size_t slot = list_hash_table_find(&index->table, index->hash(key), node_matches, key, index);
+    if (slot == LIST_HASH_NO_SLOT) return -1;
+    *out_data = ((LinkedListNode *)index->table.slots[slot].item)->data;
+    return 0;
+};
+
+// Checks whether an element equal to key is in the list, through the hash index
+// returns 1 if it is, 0 if it is not or if the list has no index
+int list_contains(LinkedList *list, const void *key) {
+    void * data;
+    return list_find(list, key, &data) == 0;
+};
@@ -0,0 +1,153 @@
+#include "list_intrusive.h"
+#include <stddef.h>
+
+// Makes list an empty intrusive list, call it before any other use
+void list_intrusive_init(IntrusiveList *list) {
+    if (list == NULL) return;
+    list->head.next = &list->head;
+    list->head.prev = &list->head;
+    list->size = 0;
+};
+
+// Links link in between prev and next
+static void link_between(ListLink *link, ListLink *prev, ListLink *next) {
+    link->prev = prev;
+    link->next = next;
+    prev->next = link;
+    next->prev = link;
+}
+
+// Appends the element with link at the end in O(1)
+// returns 0 on success, -1 on failure
+int list_intrusive_add(IntrusiveList *list, ListLink *link) {
+    if (list == NULL || link == NULL) return -1;
+    link_between(link, list->head.prev, &list->head);
+    list->size++;
+    return 0;
+};
+
+// Puts the element with link at the front in O(1)
+// returns 0 on success, -1 on failure
+int list_intrusive_push_front(IntrusiveList *list, ListLink *link) {
+    if (list == NULL || link == NULL) return -1;
+    link_between(link, &list->head, list->head.next);
+    list->size++;
+    return 0;
+};
+
+// Inserts the element with link right before position, which must be in list,
+// in O(1). A NULL position appends.
+// returns 0 on success, -1 on failure
+int list_intrusive_insert_before(IntrusiveList *list, ListLink *position, ListLink *link) {
+    if (list == NULL || link == NULL) return -1;
+    if (position == NULL) position = &list->head;
+    link_between(link, position->prev, position);
+    list->size++;
+    return 0;
+};
+
+// Removes the element with link, which must be in list, in O(1).
+// The links are cleared, so list_intrusive_is_linked tells it is out.
+// returns 0 on success, -1 on failure
+int list_intrusive_remove(IntrusiveList *list, ListLink *link) {
+    if (list == NULL || link == NULL || link->next == NULL || list->size == 0) return -1;
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    link->next = NULL;
+    link->prev = NULL;
+    list->size--;
+    return 0;
+};
+
+// Tells whether link is currently in some intrusive list.
+// Only reliable for links zeroed before first use or removed with list_intrusive_remove.
+int list_intrusive_is_linked(const ListLink *link) {
+    return link != NULL && link->next != NULL;
+};
+
+// Returns the first link, NULL if the list is empty
+ListLink *list_intrusive_first(const IntrusiveList *list) {
+    if (list == NULL || list->size == 0) return NULL;
+    return list->head.next;
+};
+
+// Returns the last link, NULL if the list is empty
+ListLink *list_intrusive_last(const IntrusiveList *list) {
+    if (list == NULL || list->size == 0) return NULL;
+    return list->head.prev;
+};
+
+// Returns the link after link, NULL at the end
+ListLink *list_intrusive_next(const IntrusiveList *list, const ListLink *link) {
+    if (list == NULL || link == NULL || link->next == &list->head) return NULL;
+    return link->next;
+};
+
+// Returns the link before link, NULL at the start
+ListLink *list_intrusive_prev(const IntrusiveList *list, const ListLink *link) {
+    if (list == NULL || link == NULL || link->prev == &list->head) return NULL;
+    return link->prev;
+};
+
+// Returns the number of elements in the list
+size_t list_intrusive_size(const IntrusiveList *list) {
+    if (list == NULL) return 0;
+    return list->size;
+};
+
+// Merges two sorted NULL terminated chains (only next is used), taking from
+// left on ties so the merge is stable
+static ListLink *merge_links(ListLink *left, ListLink *right, int (*compare)(const ListLink *, const ListLink *)) {
+    ListLink head;
+    ListLink *last = &head;
+
+    while (left != NULL && right != NULL) {
+        if (compare(left, right) <= 0) {
+            last->next = left;
+            left = left->next;
+        } else {
+            last->next = right;
+            right = right->next;
+        }
+        last = last->next;
+    }
+    last->next = left != NULL ? left : right;
+    return head.next;
+}
+
+// Sorts a NULL terminated chain of count links, which are counted up front so
+// splitting only walks to the middle instead of counting every level again
+static ListLink *sort_links(ListLink *head, size_t count, int (*compare)(const ListLink *, const ListLink *)) {
+    if (count < 2) return head;
+
+    size_t left_count = count / 2;
+    ListLink * cursor = head;
+    for (size_t i = 0; i < left_count - 1; i++) {
+        cursor = cursor->next;
+    }
+    ListLink * right = cursor->next;
+    cursor->next = NULL;
+
+    ListLink * left = sort_links(head, left_count, compare);
+    right = sort_links(right, count - left_count, compare);
+    return merge_links(left, right, compare);
+}
+
+// Sorts the list with a stable merge sort, the same way list_merge_sort does.
+// compare gets two links, use LIST_CONTAINER_OF to get at the elements.
+void list_intrusive_merge_sort(IntrusiveList *list, int (*compare)(const ListLink *, const ListLink *)) {
+    if (list == NULL || compare == NULL || list->size < 2) return;
+
+    // sort as a plain singly linked chain, then put the prev links and the ring back
+    list->head.prev->next = NULL;
+    ListLink * sorted = sort_links(list->head.next, list->size, compare);
+
+    ListLink * prev = &list->head;
+    for (ListLink * link = sorted; link != NULL; link = link->next) {
+        prev->next = link;
+        link->prev = prev;
+        prev = link;
+    }
+    prev->next = &list->head;
+    list->head.prev = prev;
+};
@@ -0,0 +1,80 @@
+#ifndef LIST_INTRUSIVE_H
+#define LIST_INTRUSIVE_H
+
+#include <stddef.h>
+
+// Intrusive lists
+//
+// Instead of the list allocating a node that points at the element, the element
+// carries the links itself: put a ListLink member in your struct, hand the list
+// a pointer to that member and get your struct back with LIST_CONTAINER_OF.
+// The list never allocates, and an element can be removed in O(1) from its link.
+// An element can be in as many intrusive lists as it has ListLink members.
+
+// The links an element embeds, one per intrusive list it can be in
+typedef struct ListLink {
+    struct ListLink * next;
+    struct ListLink * prev;
+} ListLink;
+
+// An intrusive list. The struct is public so it can be embedded or live on the stack,
+// but its fields are only meant to be touched through the functions below.
+typedef struct IntrusiveList {
+    // sentinel of a circular chain, so no operation has to special case the ends
+    ListLink head;
+    size_t size;
+} IntrusiveList;
+
+// Gets the struct of type that has link as its member called member
+#define LIST_CONTAINER_OF(link, type, member) ((type *)((char *)(link) - offsetof(type, member)))
+
+// Walks every link of list from first to last. The loop body must not
+// remove the current link, use list_intrusive_next before removing it instead.
+#define LIST_INTRUSIVE_FOREACH(link, list) \
+    for (ListLink * link = list_intrusive_first(list); link != NULL; link = list_intrusive_next(list, link))
+
+// Makes list an empty intrusive list, call it before any other use
+void list_intrusive_init(IntrusiveList *list);
+
+// Appends the element with link at the end in O(1)
+// returns 0 on success, -1 on failure
+int list_intrusive_add(IntrusiveList *list, ListLink *link);
+
+// Puts the element with link at the front in O(1)
+// returns 0 on success, -1 on failure
+int list_intrusive_push_front(IntrusiveList *list, ListLink *link);
+
+// Inserts the element with link right before position, which must be in list,
+// in O(1). A NULL position appends.
+// returns 0 on success, -1 on failure
+int list_intrusive_insert_before(IntrusiveList *list, ListLink *position, ListLink *link);
+
+// Removes the element with link, which must be in list, in O(1).
+// The links are cleared, so list_intrusive_is_linked tells it is out.
+// returns 0 on success, -1 on failure
+int list_intrusive_remove(IntrusiveList *list, ListLink *link);
+
+// Tells whether link is currently in some intrusive list.
+// Only reliable for links zeroed before first use or removed with list_intrusive_remove.
+int list_intrusive_is_linked(const ListLink *link);
+
+// Returns the first link, NULL if the list is empty
+ListLink *list_intrusive_first(const IntrusiveList *list);
+
+// Returns the last link, NULL if the list is empty
+ListLink *list_intrusive_last(const IntrusiveList *list);
+
+// Returns the link after link, NULL at the end
+ListLink *list_intrusive_next(const IntrusiveList *list, const ListLink *link);
+
+// Returns the link before link, NULL at the start
+ListLink *list_intrusive_prev(const IntrusiveList *list, const ListLink *link);
+
+// Returns the number of elements in the list
+size_t list_intrusive_size(const IntrusiveList *list);
+
+// Sorts the list with a stable merge sort, the same way list_merge_sort does.
+// compare gets two links, use LIST_CONTAINER_OF to get at the elements.
+void list_intrusive_merge_sort(IntrusiveList *list, int (*compare)(const ListLink *, const ListLink *));
+
+#endif //LIST_INTRUSIVE_H
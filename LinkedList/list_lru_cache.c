@@ -0,0 +1,309 @@
+#include "list_lru_cache.h"
+#include "linked_list_internal.h"
+#include "list_intrusive.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// LRU cache
+//
+// Every pair lives in an entry that embeds its link in the recency list, most
+// recently used first, so promoting or evicting a pair is a couple of pointer
+// writes. The entries are also the items of an open addressing table (the one
+// the hash index of a list uses) that maps keys to them. A cache that is full
+// evicts on every put of a new key, so the entry of the last evicted pair is
+// kept and reused instead of going back to malloc.
+
+typedef struct LruEntry {
+    ListLink link;
+    void * key;
+    void * value;
+    size_t hash;
+    size_t cost;
+} LruEntry;
+
+struct ListLruCache {
+    size_t (*hash)(const void *key);
+    int (*equals)(const void *a, const void *b);
+    size_t (*cost)(const void *key, const void *value);
+    void (*on_evict)(void *key, void *value, void *ctx);
+    void * evict_ctx;
+    size_t max_count;
+    size_t max_cost;
+    size_t total_cost;
+    // most recently used first
+    IntrusiveList recency;
+    // items are LruEntry, its count is the number of pairs
+    ListHashTable table;
+    // entry of the last pair that left the cache, NULL if none is kept
+    LruEntry * spare;
+};
+
+// Tells whether the entry item has a key equal to key, for list_hash_table_find
+static int entry_matches(const void *item, const void *key, const void *ctx) {
+    const ListLruCache * cache = ctx;
+    return cache->equals(((const LruEntry *)item)->key, key);
+}
+
+// Finds the slot of the entry whose key equals key
+// returns LIST_HASH_NO_SLOT if there is none
+static size_t find_slot(const ListLruCache *cache, const void *key, size_t hash) {
+    return list_hash_table_find(&cache->table, hash, entry_matches, key, cache);
+}
+
+// The entry in a slot find_slot returned
+static LruEntry *slot_entry(const ListLruCache *cache, size_t slot) {
+    return cache->table.slots[slot].item;
+}
+
+// Takes an entry out of the table and the recency list
+static void unlink_entry(ListLruCache *cache, LruEntry *entry, size_t slot) {
+    if (slot == LIST_HASH_NO_SLOT) slot = list_hash_table_find_item(&cache->table, entry, entry->hash);
+    list_hash_table_erase(&cache->table, slot);
+    list_intrusive_remove(&cache->recency, &entry->link);
+    cache->total_cost -= entry->cost;
+}
+
+// Keeps the entry of a pair that left the cache for the next put, or frees it
+static void release_entry(ListLruCache *cache, LruEntry *entry) {
+    if (cache->spare == NULL) {
+        cache->spare = entry;
+    } else {
+        free(entry);
+    }
+}
+
+// Makes an entry the most recently used one
+static void touch(ListLruCache *cache, LruEntry *entry) {
+    if (list_intrusive_first(&cache->recency) == &entry->link) return;
+    list_intrusive_remove(&cache->recency, &entry->link);
+    list_intrusive_push_front(&cache->recency, &entry->link);
+}
+
+// Evicts the least recently used pair and hands it to the eviction callback
+static void evict_last(ListLruCache *cache) {
+    LruEntry * entry = LIST_CONTAINER_OF(list_intrusive_last(&cache->recency), LruEntry, link);
+    unlink_entry(cache, entry, LIST_HASH_NO_SLOT);
+    if (cache->on_evict != NULL) cache->on_evict(entry->key, entry->value, cache->evict_ctx);
+    release_entry(cache, entry);
+}
+
+// Tells whether the cache is over a limit, counting extra_cost more cost.
+// extra_count says whether a pair is about to be added.
+static int over_limit(const ListLruCache *cache, size_t extra_count, size_t extra_cost) {
+    if (cache->max_count != 0 && cache->table.count + extra_count > cache->max_count) return 1;
+    return cache->cost != NULL && cache->total_cost + extra_cost > cache->max_cost;
+}
+
+// Creates an empty cache holding at most max_count pairs (0 for no limit on the count).
+// hash and equals work on keys, equal keys must hash the same.
+// returns NULL on failure
+ListLruCache *list_lru_cache_create(size_t max_count, size_t (*hash)(const void *key),
+                                    int (*equals)(const void *a, const void *b)) {
+    if (hash == NULL || equals == NULL) return NULL;
+
+    ListLruCache * cache = malloc(sizeof(ListLruCache));
+    if (cache == NULL) return NULL;
+    if (list_hash_table_init(&cache->table, 0, NULL) != 0) {
+        free(cache);
+        return NULL;
+    }
+    cache->hash = hash;
+    cache->equals = equals;
+    cache->cost = NULL;
+    cache->on_evict = NULL;
+    cache->evict_ctx = NULL;
+    cache->max_count = max_count;
+    cache->max_cost = 0;
+    cache->total_cost = 0;
+    list_intrusive_init(&cache->recency);
+    cache->spare = NULL;
+    return cache;
+};
+
+// Also limits the cache by cost: cost gives what a pair costs (bytes, say) and the
+// pairs in the cache may cost max_cost together. The cost of a pair is taken once,
+// when it is put. Pairs are evicted right away if the cache is over the new limit.
+// returns 0 on success, -1 on failure
+int list_lru_cache_set_cost_limit(ListLruCache *cache, size_t max_cost,
+                                  size_t (*cost)(const void *key, const void *value)) {
+    if (cache == NULL || cost == NULL) return -1;
+    cache->cost = cost;
+    cache->max_cost = max_cost;
+
+    // pairs put before there was a cost function have to be costed now
+    cache->total_cost = 0;
+    LIST_INTRUSIVE_FOREACH(link, &cache->recency) {
+        LruEntry * entry = LIST_CONTAINER_OF(link, LruEntry, link);
+        entry->cost = cost(entry->key, entry->value);
+        cache->total_cost += entry->cost;
+    }
+    while (cache->table.count > 0 && over_limit(cache, 0, 0)) {
+        evict_last(cache);
+    }
+    return 0;
+};
+
+// Sets the function every evicted pair is handed to, with ctx, so the caller can
+// free it. It must not use the cache. NULL turns it off.
+void list_lru_cache_set_evict_callback(ListLruCache *cache,
+                                       void (*on_evict)(void *key, void *value, void *ctx), void *ctx) {
+    if (cache == NULL) return;
+    cache->on_evict = on_evict;
+    cache->evict_ctx = ctx;
+};
+
+// Looks up the value for key and makes the pair the most recently used
+// returns 0 and stores the value in *out_value if found, -1 if not
+int list_lru_cache_get(ListLruCache *cache, const void *key, void **out_value) {
+    if (cache == NULL || out_value == NULL) return -1;
+    size_t slot = find_slot(cache, key, cache->hash(key));
+    if (slot == LIST_HASH_NO_SLOT) return -1;
+
+    LruEntry * entry = slot_entry(cache, slot);
+    touch(cache, entry);
+    *out_value = entry->value;
+    return 0;
+};
+
+// Looks up the value for key without changing how recently it was used
+// returns 0 and stores the value in *out_value if found, -1 if not
+int list_lru_cache_peek(const ListLruCache *cache, const void *key, void **out_value) {
+    if (cache == NULL || out_value == NULL) return -1;
+    size_t slot = find_slot(cache, key, cache->hash(key));
+    if (slot == LIST_HASH_NO_SLOT) return -1;
+    *out_value = slot_entry(cache, slot)->value;
+    return 0;
+};
+
+// Does the work of list_lru_cache_put and list_lru_cache_replace. A pair with an
+// equal key already in the cache is stored in *out_old_key and *out_old_value,
+// or handed to the eviction callback when out_old_key is NULL.
+// returns 1 if a pair was replaced, 0 if the key was new, -1 on failure
+static int put(ListLruCache *cache, void *key, void *value, void **out_old_key, void **out_old_value) {
+    if (cache == NULL) return -1;
+    size_t cost = cache->cost != NULL ? cache->cost(key, value) : 0;
+    if (cache->cost != NULL && cost > cache->max_cost) return -1;
+
+    // get everything that can fail out of the way before the cache changes
+    if (list_hash_table_reserve(&cache->table, 1) != 0) return -1;
+    LruEntry * entry = cache->spare;
+    if (entry != NULL) {
+        cache->spare = NULL;
+    } else {
+        entry = malloc(sizeof(LruEntry));
+        if (entry == NULL) return -1;
+    }
+
+    size_t hash = cache->hash(key);
+    size_t slot = find_slot(cache, key, hash);
+    int replaced = slot != LIST_HASH_NO_SLOT;
+    if (replaced) {
+        LruEntry * old = slot_entry(cache, slot);
+        unlink_entry(cache, old, slot);
+        if (out_old_key != NULL) {
+            *out_old_key = old->key;
+            *out_old_value = old->value;
+        } else if (cache->on_evict != NULL) {
+            cache->on_evict(old->key, old->value, cache->evict_ctx);
+        }
+        release_entry(cache, old);
+    }
+    while (cache->table.count > 0 && over_limit(cache, 1, cost)) {
+        evict_last(cache);
+    }
+
+    entry->key = key;
+    entry->value = value;
+    entry->hash = hash;
+    entry->cost = cost;
+    list_hash_table_put(&cache->table, entry, hash);
+    list_intrusive_push_front(&cache->recency, &entry->link);
+    cache->total_cost += cost;
+    return replaced;
+}
+
+// Adds a pair as the most recently used one. A pair with an equal key that is
+// already in the cache is replaced, and since the cache lets go of it, it goes to
+// the eviction callback like an evicted pair (list_lru_cache_replace hands it
+// back instead). Then the least recently used pairs are evicted until the cache
+// is within its limits again.
+// returns 0 on success, -1 on failure (also when the pair alone costs more than the cost limit)
+int list_lru_cache_put(ListLruCache *cache, void *key, void *value) {
+    return put(cache, key, value, NULL, NULL) < 0 ? -1 : 0;
+};
+
+// Same as list_lru_cache_put, but a pair with an equal key that is already in
+// the cache is stored in *out_old_key and *out_old_value instead of going to the
+// eviction callback. Pairs evicted to stay within the limits still go to it.
+// returns 1 if a pair was replaced, 0 if the key was new, -1 on failure
+int list_lru_cache_replace(ListLruCache *cache, void *key, void *value, void **out_old_key, void **out_old_value) {
+    if (out_old_key == NULL || out_old_value == NULL) return -1;
+    return put(cache, key, value, out_old_key, out_old_value);
+};
+
+// Makes the pair with key the most recently used without reading it
+// returns 0 on success, -1 if the key is not in the cache
+int list_lru_cache_promote(ListLruCache *cache, const void *key) {
+    if (cache == NULL) return -1;
+    size_t slot = find_slot(cache, key, cache->hash(key));
+    if (slot == LIST_HASH_NO_SLOT) return -1;
+    touch(cache, slot_entry(cache, slot));
+    return 0;
+};
+
+// Takes the least recently used pair out of the cache and stores it in *out_key and
+// *out_value (either may be NULL). The eviction callback is not called, the pair goes to the caller.
+// returns 0 on success, -1 if the cache is empty
+int list_lru_cache_evict(ListLruCache *cache, void **out_key, void **out_value) {
+    if (cache == NULL || cache->table.count == 0) return -1;
+    LruEntry * entry = LIST_CONTAINER_OF(list_intrusive_last(&cache->recency), LruEntry, link);
+    unlink_entry(cache, entry, LIST_HASH_NO_SLOT);
+    if (out_key != NULL) *out_key = entry->key;
+    if (out_value != NULL) *out_value = entry->value;
+    release_entry(cache, entry);
+    return 0;
+};
+
+// Takes the pair with key out of the cache and stores it in *out_key and *out_value
+// (either may be NULL). The eviction callback is not called.
+// returns 0 on success, -1 if the key is not in the cache
+int list_lru_cache_remove(ListLruCache *cache, const void *key, void **out_key, void **out_value) {
+    if (cache == NULL) return -1;
+    size_t slot = find_slot(cache, key, cache->hash(key));
+    if (slot == LIST_HASH_NO_SLOT) return -1;
+
+    LruEntry * entry = slot_entry(cache, slot);
+    unlink_entry(cache, entry, slot);
+    if (out_key != NULL) *out_key = entry->key;
+    if (out_value != NULL) *out_value = entry->value;
+    release_entry(cache, entry);
+    return 0;
+};
+
+// Returns the number of pairs in the cache
+size_t list_lru_cache_size(const ListLruCache *cache) {
+    if (cache == NULL) return 0;
+    return cache->table.count;
+};
+
+// Returns what the pairs in the cache cost together, 0 without a cost limit
+size_t list_lru_cache_cost(const ListLruCache *cache) {
+    if (cache == NULL) return 0;
+    return cache->total_cost;
+};
+
+// Hands every pair still in the cache to the eviction callback and frees the cache
+void list_lru_cache_destroy(ListLruCache *cache) {
+    if (cache == NULL) return;
+    ListLink * link = list_intrusive_first(&cache->recency);
+    while (link != NULL) {
+        LruEntry * entry = LIST_CONTAINER_OF(link, LruEntry, link);
+        link = list_intrusive_next(&cache->recency, link);
+        if (cache->on_evict != NULL) cache->on_evict(entry->key, entry->value, cache->evict_ctx);
+        free(entry);
+    }
+    free(cache->spare);
+    list_hash_table_free(&cache->table);
+    free(cache);
+};
@@ -0,0 +1,76 @@
+#ifndef LIST_LRU_CACHE_H
+#define LIST_LRU_CACHE_H
+
+#include <stddef.h>
+
+// A least-recently-used cache of key/value pairs (both void pointers).
+// Lookups go through a hash table and recency is kept in an intrusive list,
+// so get, put, promote and evict are all O(1). When the cache goes over its
+// limits it evicts the least recently used pairs and hands each of them to the
+// eviction callback, if one is set.
+typedef struct ListLruCache ListLruCache;
+
+// Creates an empty cache holding at most max_count pairs (0 for no limit on the count).
+// hash and equals work on keys, equal keys must hash the same.
+// returns NULL on failure
+ListLruCache *list_lru_cache_create(size_t max_count, size_t (*hash)(const void *key),
+                                    int (*equals)(const void *a, const void *b));
+
+// Also limits the cache by cost: cost gives what a pair costs (bytes, say) and the
+// pairs in the cache may cost max_cost together. The cost of a pair is taken once,
+// when it is put. Pairs are evicted right away if the cache is over the new limit.
+// returns 0 on success, -1 on failure
+int list_lru_cache_set_cost_limit(ListLruCache *cache, size_t max_cost,
+                                  size_t (*cost)(const void *key, const void *value));
+
+// Sets the function every evicted pair is handed to, with ctx, so the caller can
+// free it. It must not use the cache. NULL turns it off.
+void list_lru_cache_set_evict_callback(ListLruCache *cache,
+                                       void (*on_evict)(void *key, void *value, void *ctx), void *ctx);
+
+// Looks up the value for key and makes the pair the most recently used
+// returns 0 and stores the value in *out_value if found, -1 if not
+int list_lru_cache_get(ListLruCache *cache, const void *key, void **out_value);
+
+// Looks up the value for key without changing how recently it was used
+// returns 0 and stores the value in *out_value if found, -1 if not
+int list_lru_cache_peek(const ListLruCache *cache, const void *key, void **out_value);
+
+// Adds a pair as the most recently used one. A pair with an equal key that is
+// already in the cache is replaced, and since the cache lets go of it, it goes to
+// the eviction callback like an evicted pair (list_lru_cache_replace hands it
+// back instead). Then the least recently used pairs are evicted until the cache
+// is within its limits again.
+// returns 0 on success, -1 on failure (also when the pair alone costs more than the cost limit)
+int list_lru_cache_put(ListLruCache *cache, void *key, void *value);
+
+// Same as list_lru_cache_put, but a pair with an equal key that is already in
+// the cache is stored in *out_old_key and *out_old_value instead of going to the
+// eviction callback. Pairs evicted to stay within the limits still go to it.
+// returns 1 if a pair was replaced, 0 if the key was new, -1 on failure
+int list_lru_cache_replace(ListLruCache *cache, void *key, void *value, void **out_old_key, void **out_old_value);
+
+// Makes the pair with key the most recently used without reading it
+// returns 0 on success, -1 if the key is not in the cache
+int list_lru_cache_promote(ListLruCache *cache, const void *key);
+
+// Takes the least recently used pair out of the cache and stores it in *out_key and
+// *out_value (either may be NULL). The eviction callback is not called, the pair goes to the caller.
+// returns 0 on success, -1 if the cache is empty
+int list_lru_cache_evict(ListLruCache *cache, void **out_key, void **out_value);
+
+// Takes the pair with key out of the cache and stores it in *out_key and *out_value
+// (either may be NULL). The eviction callback is not called.
+// returns 0 on success, -1 if the key is not in the cache
+int list_lru_cache_remove(ListLruCache *cache, const void *key, void **out_key, void **out_value);
+
+// Returns the number of pairs in the cache
+size_t list_lru_cache_size(const ListLruCache *cache);
+
+// Returns what the pairs in the cache cost together, 0 without a cost limit
+size_t list_lru_cache_cost(const ListLruCache *cache);
+
+// Hands every pair still in the cache to the eviction callback and frees the cache
+void list_lru_cache_destroy(ListLruCache *cache);
+
+#endif //LIST_LRU_CACHE_H
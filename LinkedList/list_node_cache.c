@@ -0,0 +1,203 @@
+#include "linked_list.h"
+#include "linked_list_internal.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+// Thread-local node caches
+//
+// Every thread keeps a small stack of free nodes, so list_add and friends
+// normally get a node without touching malloc or any lock. A thread that runs
+// dry takes a whole batch from a shared depot (or mallocs one), and a thread
+// that frees more than it allocates, for example one that destroys lists built
+// elsewhere, hands whole batches back. The depot is capped, anything beyond the
+// cap goes back to malloc so a big teardown does not pin memory forever.
+// Once a thread's cache is torn down at exit, any node the thread still frees
+// or allocates (from other thread-exit destructors) goes straight to malloc.
+
+#define CACHE_BATCH 256
+#define CACHE_MAX (2 * CACHE_BATCH)
+#define DEPOT_MAX_BATCHES 64
+
+// Free nodes are chained through next. In the depot the first node of every
+// batch also points at the next batch through its data field.
+typedef struct NodeCache {
+    LinkedListNode * free_nodes;
+    size_t count;
+    // while count is above CACHE_BATCH, the node right in front of the oldest
+    // CACHE_BATCH nodes (the bottom of the stack), which are the next to go to
+    // the depot; nodes only come and go at the top, so it stays put until then
+    LinkedListNode * boundary;
+    int registered;
+    // set once the thread-exit destructor has flushed the cache, nothing
+    // would flush it again
+    int torn_down;
+} NodeCache;
+
+static _Thread_local NodeCache cache = {NULL, 0, NULL, 0, 0};
+
+static pthread_mutex_t depot_lock = PTHREAD_MUTEX_INITIALIZER;
+static LinkedListNode * depot = NULL;
+static size_t depot_batches = 0;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+
+// Frees a chain of free nodes back to malloc
+static void free_chain(LinkedListNode *node) {
+    while (node != NULL) {
+        LinkedListNode * to_delete = node;
+        node = node->next;
+        free(to_delete);
+    }
+}
+
+// Parks a batch of free nodes in the depot, or frees it if the depot is full
+static void depot_push(LinkedListNode *batch) {
+    pthread_mutex_lock(&depot_lock);
+    if (depot_batches < DEPOT_MAX_BATCHES) {
+        batch->data = depot;
+        depot = batch;
+        depot_batches++;
+        batch = NULL;
+    }
+    pthread_mutex_unlock(&depot_lock);
+    free_chain(batch);
+}
+
+// Takes a batch of free nodes from the depot
+// returns NULL if the depot is empty
+static LinkedListNode *depot_pop(void) {
+    pthread_mutex_lock(&depot_lock);
+    LinkedListNode * batch = depot;
+    if (batch != NULL) {
+        depot = batch->data;
+        depot_batches--;
+    }
+    pthread_mutex_unlock(&depot_lock);
+    return batch;
+}
+
+// Hands every node cached by the calling thread to the depot, in full batches
+static void flush_cache(NodeCache *node_cache) {
+    while (node_cache->free_nodes != NULL) {
+        LinkedListNode * batch = node_cache->free_nodes;
+        LinkedListNode * last = batch;
+        for (size_t i = 1; i < CACHE_BATCH && last->next != NULL; i++) {
+            last = last->next;
+        }
+        node_cache->free_nodes = last->next;
+        last->next = NULL;
+        depot_push(batch);
+    }
+    node_cache->count = 0;
+    node_cache->boundary = NULL;
+}
+
+// Runs when a thread that used the cache exits, so its nodes are not lost
+static void cache_destructor(void *arg) {
+    NodeCache * node_cache = arg;
+    flush_cache(node_cache);
+    node_cache->torn_down = 1;
+}
+
+static void create_key(void) {
+    pthread_key_create(&cache_key, cache_destructor);
+}
+
+// Fills the calling thread's cache with a batch from the depot or, failing that, from malloc
+static void refill(void) {
+    if (!cache.registered) {
+        pthread_once(&key_once, create_key);
+        pthread_setspecific(cache_key, &cache);
+        cache.registered = 1;
+    }
+
+    LinkedListNode * batch = depot_pop();
+    if (batch != NULL) {
+        size_t count = 1;
+        for (LinkedListNode * node = batch; node->next != NULL; node = node->next) {
+            count++;
+        }
+        cache.free_nodes = batch;
+        cache.count = count;
+        return;
+    }
+
+    for (size_t i = 0; i < CACHE_BATCH; i++) {
+        LinkedListNode * node = malloc(sizeof(LinkedListNode));
+        if (node == NULL) break;
+        node->next = cache.free_nodes;
+        cache.free_nodes = node;
+        cache.count++;
+    }
+}
+
+// Gets a node from the calling thread's cache
+// returns NULL on failure
+LinkedListNode *list_node_cache_alloc(void) {
+    if (cache.torn_down) return malloc(sizeof(LinkedListNode));
+    if (cache.free_nodes == NULL) {
+        refill();
+        if (cache.free_nodes == NULL) return NULL;
+    }
+    LinkedListNode * node = cache.free_nodes;
+    cache.free_nodes = node->next;
+    cache.count--;
+    if (node == cache.boundary) cache.boundary = NULL;
+    return node;
+}
+
+// Gives a node to the calling thread's cache, whichever thread allocated it
+void list_node_cache_free(LinkedListNode *node) {
+    if (cache.torn_down) {
+        free(node);
+        return;
+    }
+    if (!cache.registered) {
+        pthread_once(&key_once, create_key);
+        pthread_setspecific(cache_key, &cache);
+        cache.registered = 1;
+    }
+
+    // full: hand the oldest batch (the bottom of the stack) to the depot, the
+    // node coming in is the hot one and stays
+    if (cache.count == CACHE_MAX) {
+        LinkedListNode * batch = cache.boundary->next;
+        cache.boundary->next = NULL;
+        cache.count -= CACHE_BATCH;
+        depot_push(batch);
+    }
+
+    node->next = cache.free_nodes;
+    cache.free_nodes = node;
+    cache.count++;
+    if (cache.count == CACHE_BATCH + 1) cache.boundary = node;
+}
+
+// Hands the nodes cached by the calling thread to the shared depot, so other
+// threads can use them. Threads do this on their own when they exit.
+void list_node_cache_flush(void) {
+    flush_cache(&cache);
+};
+
+// Frees the calling thread's cached nodes and everything in the shared depot
+// back to malloc
+void list_node_cache_trim(void) {
+    free_chain(cache.free_nodes);
+    cache.free_nodes = NULL;
+    cache.count = 0;
+    cache.boundary = NULL;
+
+    pthread_mutex_lock(&depot_lock);
+    LinkedListNode * batches = depot;
+    depot = NULL;
+    depot_batches = 0;
+    pthread_mutex_unlock(&depot_lock);
+
+    while (batches != NULL) {
+        LinkedListNode * next_batch = batches->data;
+        free_chain(batches);
+        batches = next_batch;
+    }
+};
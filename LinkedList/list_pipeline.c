@@ -0,0 +1,182 @@
+#include "linked_list.h"
+#include "linked_list_internal.h"
+#include <stddef.h>
+#include <stdlib.h>
+
+// Fused filter/map/reduce pipeline
+//
+// Stages are only recorded when they are added. Running the pipeline walks the
+// node chain once and pushes every element through all stages before moving on,
+// so no intermediate lists are built and the list is touched a single time.
+
+typedef enum PipelineStageKind {
+    STAGE_FILTER,
+    STAGE_MAP,
+    STAGE_REDUCE
+} PipelineStageKind;
+
+typedef struct PipelineStage {
+    PipelineStageKind kind;
+    int (*filter)(const void *data, void *ctx);
+    void *(*map)(void *data, void *ctx);
+    void *(*reduce)(void *acc, void *data, void *ctx);
+    void * init;
+    void * ctx;
+} PipelineStage;
+
+struct ListPipeline {
+    PipelineStage * stages;
+    size_t count;
+    size_t capacity;
+};
+
+// Creates an empty pipeline
+ListPipeline *list_pipeline_create(void) {
+    ListPipeline * pipeline = malloc(sizeof(ListPipeline));
+    if (pipeline == NULL) return NULL;
+    pipeline->stages = NULL;
+    pipeline->count = 0;
+    pipeline->capacity = 0;
+    return pipeline;
+};
+
+// Appends a stage, a reduce has to stay the last one
+// returns 0 on success, -1 on failure
+static int add_stage(ListPipeline *pipeline, PipelineStage stage) {
+    if (pipeline == NULL) return -1;
+    if (pipeline->count > 0 && pipeline->stages[pipeline->count - 1].kind == STAGE_REDUCE) return -1;
+
+    if (pipeline->count == pipeline->capacity) {
+        size_t capacity = pipeline->capacity == 0 ? 4 : pipeline->capacity * 2;
+        PipelineStage * stages = realloc(pipeline->stages, capacity * sizeof(PipelineStage));
+        if (stages == NULL) return -1;
+        pipeline->stages = stages;
+        pipeline->capacity = capacity;
+    }
+    pipeline->stages[pipeline->count++] = stage;
+    return 0;
+}
+
+// Adds a stage that only lets elements through when filter returns nonzero
+// returns 0 on success, -1 on failure
+int list_pipeline_filter(ListPipeline *pipeline, int (*filter)(const void *data, void *ctx), void *ctx) {
+    if (filter == NULL) return -1;
+    PipelineStage stage = {STAGE_FILTER, filter, NULL, NULL, NULL, ctx};
+    return add_stage(pipeline, stage);
+};
+
+// Adds a stage that replaces every element with what map returns for it
+// returns 0 on success, -1 on failure
+int list_pipeline_map(ListPipeline *pipeline, void *(*map)(void *data, void *ctx), void *ctx) {
+    if (map == NULL) return -1;
+    PipelineStage stage = {STAGE_MAP, NULL, map, NULL, NULL, ctx};
+    return add_stage(pipeline, stage);
+};
+
+// Adds the final stage, which folds every element into an accumulator starting at init
+// no stage can be added after it
+// returns 0 on success, -1 on failure
+int list_pipeline_reduce(ListPipeline *pipeline, void *(*reduce)(void *acc, void *data, void *ctx),
+                         void *init, void *ctx) {
+    if (reduce == NULL) return -1;
+    PipelineStage stage = {STAGE_REDUCE, NULL, NULL, reduce, init, ctx};
+    return add_stage(pipeline, stage);
+};
+
+// Pushes one element through the filter and map stages
+// returns 1 if it made it to the end, 0 if a filter dropped it
+static int run_stages(const ListPipeline *pipeline, void **data) {
+    for (size_t i = 0; i < pipeline->count; i++) {
+        const PipelineStage * stage = &pipeline->stages[i];
+        if (stage->kind == STAGE_FILTER) {
+            if (!stage->filter(*data, stage->ctx)) return 0;
+        } else if (stage->kind == STAGE_MAP) {
+            *data = stage->map(*data, stage->ctx);
+        }
+    }
+    return 1;
+}
+
+// The reduce stage of a pipeline, NULL when it does not end in one
+static const PipelineStage *reduce_stage(const ListPipeline *pipeline) {
+    if (pipeline->count == 0) return NULL;
+    const PipelineStage * last = &pipeline->stages[pipeline->count - 1];
+    return last->kind == STAGE_REDUCE ? last : NULL;
+}
+
+// Runs the pipeline over the list in a single pass, leaving the list untouched.
+// If the pipeline ends in a reduce, its result is stored in *out_result
+// (out_result may be NULL when it is not needed).
+// returns 0 on success, -1 on failure
+int list_pipeline_run(const ListPipeline *pipeline, LinkedList *list, void **out_result) {
+    if (pipeline == NULL || list == NULL) return -1;
+
+    const PipelineStage * reduce = reduce_stage(pipeline);
+    void * acc = reduce != NULL ? reduce->init : NULL;
+
+    LinkedListNode * cursor = list->head;
+    for (size_t i = 0; i < list->size; i++, cursor = cursor->next) {
+        void * data = cursor->data;
+        if (!run_stages(pipeline, &data)) continue;
+        if (reduce != NULL) acc = reduce->reduce(acc, data, reduce->ctx);
+    }
+
+    if (out_result != NULL) *out_result = acc;
+    return 0;
+};
+
+// Runs the pipeline over the list in a single pass and applies it to the list itself:
+// surviving nodes store the value produced by the map stages, nodes dropped by a
+// filter are unlinked and the value they had when dropped (what the maps before the
+// filter made of it) goes to free_func (if not NULL). Either way the data a map
+// replaces is not freed here, a map that hands back a new value frees the old one itself.
+// If the pipeline ends in a reduce, its result is stored in *out_result.
+// returns 0 on success, -1 on failure
+int list_pipeline_run_in_place(const ListPipeline *pipeline, LinkedList *list,
+                               void (*free_func)(void *), void **out_result) {
+    if (pipeline == NULL || list == NULL || list_make_private(list) != 0) return -1;
+
+    const PipelineStage * reduce = reduce_stage(pipeline);
+    void * acc = reduce != NULL ? reduce->init : NULL;
+
+    LinkedListNode head;
+    LinkedListNode *last = &head;
+    LinkedListNode * cursor = list->head;
+    size_t kept = 0;
+
+    while (cursor != NULL) {
+        LinkedListNode * node = cursor;
+        cursor = cursor->next;
+
+        void * data = node->data;
+        if (!run_stages(pipeline, &data)) {
+            if (free_func != NULL) free_func(data);
+            list_node_release(list, node);
+            continue;
+        }
+        if (reduce != NULL) acc = reduce->reduce(acc, data, reduce->ctx);
+
+        node->data = data;
+        last->next = node;
+        last = node;
+        kept++;
+    }
+    last->next = NULL;
+
+    list->head = head.next;
+    list->tail = kept > 0 ? last : NULL;
+    list->size = kept;
+    // elements were dropped and replaced, so index the survivors again
+    list_index_rebuild(list);
+    list_handle_relink(list, kept);
+
+    if (out_result != NULL) *out_result = acc;
+    return 0;
+};
+
+// Destroys the pipeline, lists it ran over are not affected
+void list_pipeline_destroy(ListPipeline *pipeline) {
+    if (pipeline == NULL) return;
+    free(pipeline->stages);
+    free(pipeline);
+};
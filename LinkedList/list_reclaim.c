@@ -0,0 +1,241 @@
+#include "linked_list.h"
+#include "linked_list_internal.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+// Background reclaimer
+//
+// list_destroy_async only queues the list, so the caller never walks the chain.
+// A single reclaimer thread, started on first use, frees queued lists in batches
+// of RECLAIM_BATCH nodes and moves a list that is not done yet to the back of the
+// queue, so one huge list cannot hold up the ones queued after it.
+
+#define RECLAIM_BATCH 4096
+
+typedef struct ReclaimJob {
+    LinkedList * list;
+    void (*free_func)(void *);
+    struct ReclaimJob * next;
+} ReclaimJob;
+
+static pthread_mutex_t reclaim_lock = PTHREAD_MUTEX_INITIALIZER;
+// signalled when work is queued or the thread should stop
+static pthread_cond_t reclaim_work = PTHREAD_COND_INITIALIZER;
+// signalled when the queue runs empty
+static pthread_cond_t reclaim_idle = PTHREAD_COND_INITIALIZER;
+static ReclaimJob * queue_head = NULL;
+static ReclaimJob * queue_tail = NULL;
+static pthread_t reclaim_thread;
+static int thread_running = 0;
+static int stopping = 0;
+// set while the thread works on a job outside the lock
+static int busy = 0;
+
+// Adds a job at the back of the queue, the lock must be held
+static void enqueue(ReclaimJob *job) {
+    job->next = NULL;
+    if (queue_tail == NULL) {
+        queue_head = job;
+    } else {
+        queue_tail->next = job;
+    }
+    queue_tail = job;
+}
+
+static void *reclaimer_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&reclaim_lock);
+    for (;;) {
+        while (queue_head == NULL && !stopping) {
+            pthread_cond_wait(&reclaim_work, &reclaim_lock);
+        }
+        // stopping only takes effect once everything queued is freed
+        if (queue_head == NULL) break;
+
+        ReclaimJob * job = queue_head;
+        queue_head = job->next;
+        if (queue_head == NULL) queue_tail = NULL;
+        busy = 1;
+        pthread_mutex_unlock(&reclaim_lock);
+
+        int done = list_destroy_batch(job->list, job->free_func, RECLAIM_BATCH);
+
+        pthread_mutex_lock(&reclaim_lock);
+        busy = 0;
+        if (done) {
+            free(job);
+        } else {
+            enqueue(job);
+        }
+        if (queue_head == NULL) {
+            pthread_cond_broadcast(&reclaim_idle);
+        }
+    }
+    pthread_mutex_unlock(&reclaim_lock);
+    return NULL;
+}
+
+// Hands the list to a background thread that frees its nodes, and applies
+// free_func (if not NULL) to their data, the same way list_destroy does.
+// Returns in O(1). The list must not be used afterwards, and whatever
+// free_func touches has to stay valid until the list is actually freed.
+// Lists in an arena are destroyed right away instead, since the arena could be
+// reset or destroyed before the background thread got to them.
+// Falls back to list_destroy if the background thread cannot be used.
+void list_destroy_async(LinkedList *list, void (*free_func)(void *)) {
+    if (list == NULL) return;
+    list_record_call(LIST_RECORD_DESTROY, list, 0);
+    // nothing to walk, or nodes that live in an arena the caller may free at any time
+    if (list->head == NULL || list->arena != NULL) {
+        list_destroy_unrecorded(list, free_func);
+        return;
+    }
+
+    ReclaimJob * job = malloc(sizeof(ReclaimJob));
+    if (job == NULL) {
+        list_destroy_unrecorded(list, free_func);
+        return;
+    }
+    job->list = list;
+    job->free_func = free_func;
+
+    pthread_mutex_lock(&reclaim_lock);
+    if (!thread_running) {
+        stopping = 0;
+        if (pthread_create(&reclaim_thread, NULL, reclaimer_main, NULL) != 0) {
+            pthread_mutex_unlock(&reclaim_lock);
+            free(job);
+            list_destroy_unrecorded(list, free_func);
+            return;
+        }
+        thread_running = 1;
+    }
+    enqueue(job);
+    pthread_cond_signal(&reclaim_work);
+    pthread_mutex_unlock(&reclaim_lock);
+};
+
+// Waits until every list handed to list_destroy_async so far is freed
+void list_reclaimer_drain(void) {
+    pthread_mutex_lock(&reclaim_lock);
+    while (queue_head != NULL || busy) {
+        pthread_cond_wait(&reclaim_idle, &reclaim_lock);
+    }
+    pthread_mutex_unlock(&reclaim_lock);
+};
+
+// Frees everything still queued and stops the background thread.
+// Call it before exiting, a later list_destroy_async starts a new thread.
+void list_reclaimer_shutdown(void) {
+    pthread_mutex_lock(&reclaim_lock);
+    if (!thread_running) {
+        pthread_mutex_unlock(&reclaim_lock);
+        return;
+    }
+    stopping = 1;
+    pthread_cond_signal(&reclaim_work);
+    pthread_mutex_unlock(&reclaim_lock);
+
+    pthread_join(reclaim_thread, NULL);
+
+    pthread_mutex_lock(&reclaim_lock);
+    thread_running = 0;
+    stopping = 0;
+    pthread_mutex_unlock(&reclaim_lock);
+};
+
+// Parallel destroy
+//
+// The chain is cut into one segment per thread with a single walk, then every
+// thread runs free_func over its own segment and frees its nodes. Worth it when
+// free_func is expensive, the walk itself is no faster than list_destroy.
+
+typedef struct DestroySegment {
+    LinkedList * list;
+    LinkedListNode * head;
+    void (*free_func)(void *);
+} DestroySegment;
+
+static void *destroy_segment(void *arg) {
+    DestroySegment * segment = arg;
+    LinkedListNode * cursor = segment->head;
+    while (cursor != NULL) {
+        LinkedListNode * to_delete = cursor;
+        cursor = cursor->next;
+
+        if (segment->free_func != NULL) {
+            segment->free_func(to_delete->data);
+        }
+        // nodes of a list in inline mode live in its header, which goes at the end
+        if (!segment->list->inline_mode) list_node_release(segment->list, to_delete);
+    }
+    return NULL;
+}
+
+// Destroys the list like list_destroy, but runs free_func and frees the nodes
+// on up to nthreads threads (the calling thread included), never more threads
+// than nodes. free_func has to be safe to call from several threads at once.
+void list_destroy_parallel(LinkedList *list, void (*free_func)(void *), size_t nthreads) {
+    if (list == NULL) return;
+    list_record_call(LIST_RECORD_DESTROY, list, 0);
+
+    // lists sharing nodes with snapshots free only part of their chain, which cannot be split up front,
+    // and arena lists without a free_func have nothing to do per node
+    size_t segments = nthreads < list->size ? nthreads : list->size;
+    if (segments < 2 || list->shared || list->read_only || (list->arena != NULL && free_func == NULL)) {
+        list_destroy_unrecorded(list, free_func);
+        return;
+    }
+
+    // releasing nodes would update the handle table from every thread, and it goes anyway
+    list_handle_free(list);
+
+    DestroySegment * parts = malloc(segments * sizeof(DestroySegment));
+    pthread_t * threads = malloc(segments * sizeof(pthread_t));
+    if (parts == NULL || threads == NULL) {
+        free(parts);
+        free(threads);
+        list_destroy_unrecorded(list, free_func);
+        return;
+    }
+
+    // cut the chain into segments of (nearly) equal length
+    LinkedListNode * cursor = list->head;
+    for (size_t i = 0; i < segments; i++) {
+        size_t length = list->size / segments + (i < list->size % segments ? 1 : 0);
+        parts[i].list = list;
+        parts[i].head = cursor;
+        parts[i].free_func = free_func;
+        for (size_t j = 1; j < length; j++) {
+            cursor = cursor->next;
+        }
+        LinkedListNode * last = cursor;
+        cursor = cursor->next;
+        last->next = NULL;
+    }
+
+    // the calling thread takes the first segment, and any a thread could not be started for
+    int * started = calloc(segments, sizeof(int));
+    for (size_t i = 1; i < segments; i++) {
+        if (started != NULL && pthread_create(&threads[i], NULL, destroy_segment, &parts[i]) == 0) {
+            started[i] = 1;
+        }
+    }
+    for (size_t i = 0; i < segments; i++) {
+        if (started == NULL || !started[i]) destroy_segment(&parts[i]);
+    }
+    for (size_t i = 1; i < segments; i++) {
+        if (started != NULL && started[i]) pthread_join(threads[i], NULL);
+    }
+
+    free(started);
+    free(parts);
+    free(threads);
+
+    // the nodes are gone, what is left is the empty header
+    list->head = NULL;
+    list->tail = NULL;
+    list->size = 0;
+    list_destroy_unrecorded(list, NULL);
+};
@@ -0,0 +1,160 @@
+#include "linked_list.h"
+#include "linked_list_internal.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Call recording
+//
+// A trace is a header followed by one record per call: the operation as a byte,
+// then the list, the argument and the size as LEB128 varints, so a typical call
+// takes four to eight bytes. Lists and iterators get their numbers the first time
+// they show up while recording and keep them, lists created before recording
+// started show up first with some other call and their size, which is enough
+// for a replay to build them up front. Records are collected in a buffer under a
+// lock and written out whenever it fills up.
+
+#define RECORD_MAGIC "LLRC"
+#define RECORD_VERSION 1
+#define RECORD_BUFFER 65536
+// an op byte and three varints of at most ten bytes each
+#define RECORD_MAX_ENTRY 31
+
+static atomic_int recording = 0;
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE * record_file = NULL;
+static int record_failed = 0;
+static unsigned char buffer[RECORD_BUFFER];
+static size_t buffered = 0;
+// numbers handed out so far, they keep counting across recordings
+static uint64_t lists_seen = 0;
+static uint64_t iterators_seen = 0;
+
+// Writes out what is buffered, the lock must be held
+static void flush_buffer(void) {
+    if (buffered > 0 && fwrite(buffer, 1, buffered, record_file) != buffered) record_failed = 1;
+    buffered = 0;
+}
+
+static size_t put_varint(unsigned char *out, uint64_t value) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (unsigned char)value;
+    return length;
+}
+
+// Buffers one record on list, or on no list (0) when list is NULL. The lock must be held.
+static void put_entry(ListRecordOp op, LinkedList *list, uint64_t arg) {
+    if (list != NULL && list->record_id == 0) list->record_id = ++lists_seen;
+    if (buffered + RECORD_MAX_ENTRY > RECORD_BUFFER) flush_buffer();
+
+    buffer[buffered++] = (unsigned char)op;
+    buffered += put_varint(buffer + buffered, list != NULL ? list->record_id : 0);
+    buffered += put_varint(buffer + buffered, arg);
+    buffered += put_varint(buffer + buffered, list != NULL ? list->size : 0);
+}
+
+// Logs a call on list to the trace being recorded, if any. index is only
+// recorded for the positional calls.
+void list_record_call(ListRecordOp op, LinkedList *list, size_t index) {
+    if (!atomic_load_explicit(&recording, memory_order_relaxed) || list == NULL) return;
+    pthread_mutex_lock(&record_lock);
+    if (record_file != NULL) put_entry(op, list, index);
+    pthread_mutex_unlock(&record_lock);
+}
+
+// Logs a call on the iterator with *iterator_id, which is over list, to the trace
+// being recorded, if any. An iterator without an id (0) gets one. list may be
+// NULL when it must not be touched, the call is then recorded on no list.
+void list_record_iterator_call(ListRecordOp op, LinkedList *list, uint64_t *iterator_id) {
+    if (!atomic_load_explicit(&recording, memory_order_relaxed)) return;
+    pthread_mutex_lock(&record_lock);
+    if (record_file != NULL) {
+        if (*iterator_id == 0) *iterator_id = ++iterators_seen;
+        put_entry(op, list, *iterator_id);
+    }
+    pthread_mutex_unlock(&record_lock);
+}
+
+// Starts recording to a new trace file at path, replacing what is there
+// returns 0 on success, -1 on failure (also when already recording)
+int list_record_start(const char *path) {
+    if (path == NULL) return -1;
+    pthread_mutex_lock(&record_lock);
+    if (record_file != NULL) {
+        pthread_mutex_unlock(&record_lock);
+        return -1;
+    }
+    record_file = fopen(path, "wb");
+    if (record_file == NULL) {
+        pthread_mutex_unlock(&record_lock);
+        return -1;
+    }
+    record_failed = 0;
+    memcpy(buffer, RECORD_MAGIC, 4);
+    buffer[4] = RECORD_VERSION;
+    buffered = 5;
+    atomic_store(&recording, 1);
+    pthread_mutex_unlock(&record_lock);
+    return 0;
+};
+
+// Stops recording and closes the trace file
+// returns 0 on success, -1 if not recording or if writing the trace failed
+int list_record_stop(void) {
+    pthread_mutex_lock(&record_lock);
+    if (record_file == NULL) {
+        pthread_mutex_unlock(&record_lock);
+        return -1;
+    }
+    atomic_store(&recording, 0);
+    flush_buffer();
+    if (fclose(record_file) != 0) record_failed = 1;
+    record_file = NULL;
+    int result = record_failed ? -1 : 0;
+    pthread_mutex_unlock(&record_lock);
+    return result;
+};
+
+// Reads and checks the header of a trace, call it before list_record_read
+// returns 0 on success, -1 if in is not a trace this version can read
+int list_record_read_header(FILE *in) {
+    unsigned char header[5];
+    if (in == NULL || fread(header, 1, sizeof(header), in) != sizeof(header)) return -1;
+    if (memcmp(header, RECORD_MAGIC, 4) != 0 || header[4] != RECORD_VERSION) return -1;
+    return 0;
+};
+
+// returns 0 on success, -1 on a damaged or cut off varint
+static int get_varint(FILE *in, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(in);
+        if (byte == EOF) return -1;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) return 0;
+    }
+    return -1;
+}
+
+// Reads the next call of a trace into *entry
+// returns 1 if a call was read, 0 at the end of the trace, -1 if the trace is damaged
+int list_record_read(FILE *in, ListRecordEntry *entry) {
+    if (in == NULL || entry == NULL) return -1;
+    int op = fgetc(in);
+    if (op == EOF) return 0;
+    if (op >= LIST_RECORD_OP_COUNT) return -1;
+
+    entry->op = (ListRecordOp)op;
+    if (get_varint(in, &entry->list) != 0 || get_varint(in, &entry->arg) != 0 ||
+        get_varint(in, &entry->size) != 0) {
+        return -1;
+    }
+    return 1;
+};
@@ -0,0 +1,63 @@
+#ifndef LIST_RECORD_H
+#define LIST_RECORD_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Optional recording of list calls to a binary trace, so a real workload can be
+// captured once and replayed against other list variants (see list_replay).
+// While recording, every list_create, list_create_in_arena, list_destroy (and
+// its async and parallel forms), list_add, list_insert_at (with or without a
+// handle), list_get_at, list_remove_at, list_merge_sort and plain iterator call
+// the caller makes is logged with the list it was made on, its index and the
+// size of the list at the time. Calls the library makes itself while doing
+// something else are not. The elements themselves are not recorded.
+// Not recording it costs one branch per call. Recording is safe to use from
+// several threads at once.
+
+// The calls that are recorded
+typedef enum ListRecordOp {
+    LIST_RECORD_CREATE,
+    LIST_RECORD_DESTROY,
+    LIST_RECORD_ADD,
+    LIST_RECORD_INSERT_AT,
+    LIST_RECORD_GET_AT,
+    LIST_RECORD_REMOVE_AT,
+    LIST_RECORD_MERGE_SORT,
+    LIST_RECORD_ITERATOR_CREATE,
+    LIST_RECORD_ITERATOR_NEXT,
+    LIST_RECORD_ITERATOR_RESET,
+    LIST_RECORD_ITERATOR_DESTROY,
+    LIST_RECORD_OP_COUNT
+} ListRecordOp;
+
+// One recorded call
+typedef struct ListRecordEntry {
+    ListRecordOp op;
+    // the list the call was made on, numbered from 1 in the order lists were first
+    // seen. 0 (and a size of 0) for list_iterator_destroy, which does not look at the list.
+    uint64_t list;
+    // the index for positional calls, the iterator (numbered from 1 the same way)
+    // for iterator calls, 0 otherwise
+    uint64_t arg;
+    // size of the list right before the call
+    uint64_t size;
+} ListRecordEntry;
+
+// Starts recording to a new trace file at path, replacing what is there
+// returns 0 on success, -1 on failure (also when already recording)
+int list_record_start(const char *path);
+
+// Stops recording and closes the trace file
+// returns 0 on success, -1 if not recording or if writing the trace failed
+int list_record_stop(void);
+
+// Reads and checks the header of a trace, call it before list_record_read
+// returns 0 on success, -1 if in is not a trace this version can read
+int list_record_read_header(FILE *in);
+
+// Reads the next call of a trace into *entry
+// returns 1 if a call was read, 0 at the end of the trace, -1 if the trace is damaged
+int list_record_read(FILE *in, ListRecordEntry *entry);
+
+#endif //LIST_RECORD_H
@@ -0,0 +1,513 @@
+#if defined(__linux__)
+// fork and waitpid are not part of plain C11
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "linked_list.h"
+
+#if defined(__linux__)
+#include <sys/wait.h>
+#include <unistd.h>
+#define REPLAY_FORK 1
+#endif
+
+// Trace replay
+//
+// Runs a trace recorded with list_record_start against every list variant (or
+// the ones named) and reports how long each took and how much memory it needed.
+// Lists the trace saw before recording started are built up to the size they
+// had before the clock starts. Elements are ints numbered in the order they are
+// added, scrambled so sorting has work to do. On Linux every variant runs in a
+// child process of its own, so the peak memory of one does not hide the next.
+//
+// usage: list_replay trace [variant...]
+
+// A list implementation the trace can run against
+typedef struct ReplayEngine {
+    const char * name;
+    // set up and tear down what the lists of a run share, may be NULL
+    void (*begin)(void);
+    void (*end)(void);
+    void *(*create)(void);
+    void (*destroy)(void *list);
+    int (*add)(void *list, void *data);
+    int (*insert_at)(void *list, size_t index, void *data);
+    int (*get_at)(void *list, size_t index, void **out_data);
+    int (*remove_at)(void *list, size_t index, void **out_data);
+    void (*sort)(void *list);
+    void *(*iterator_create)(void *list);
+    int (*iterator_next)(void *iter, void **out_data);
+    void (*iterator_reset)(void *iter);
+    void (*iterator_destroy)(void *iter);
+} ReplayEngine;
+
+// A trace loaded into memory, with what the replay needs to know up front
+typedef struct ReplayTrace {
+    ListRecordEntry * entries;
+    size_t count;
+    size_t max_list;
+    size_t max_iterator;
+    // size + 1 of every list the trace did not see being created, 0 for the others
+    uint64_t * prebuilt;
+    // elements the replay adds, prebuilt lists included
+    size_t element_count;
+} ReplayTrace;
+
+typedef struct ReplayResult {
+    double seconds;
+    size_t failed;
+} ReplayResult;
+
+static int * pool;
+static size_t pool_used;
+
+static void *next_element(void) {
+    return &pool[pool_used++];
+}
+
+// LinkedList
+
+static void *linked_create(void) {
+    return list_create();
+}
+
+static void linked_destroy(void *list) {
+    list_destroy(list, NULL);
+}
+
+static int linked_add(void *list, void *data) {
+    return list_add(list, data);
+}
+
+static int linked_insert_at(void *list, size_t index, void *data) {
+    return list_insert_at(list, index, data);
+}
+
+static int linked_get_at(void *list, size_t index, void **out_data) {
+    return list_get_at(list, index, out_data);
+}
+
+static int linked_remove_at(void *list, size_t index, void **out_data) {
+    return list_remove_at(list, index, out_data);
+}
+
+static void linked_sort(void *list) {
+    list_merge_sort(list, compare_ints);
+}
+
+static void *linked_iterator_create(void *list) {
+    return list_iterator_create(list);
+}
+
+static int linked_iterator_next(void *iter, void **out_data) {
+    return list_iterator_next(iter, out_data);
+}
+
+static void linked_iterator_reset(void *iter) {
+    list_iterator_reset(iter);
+}
+
+static void linked_iterator_destroy(void *iter) {
+    list_iterator_destroy(iter);
+}
+
+// LinkedList in an arena, all lists of a run share it
+
+static ListArena * replay_arena;
+
+static void arena_begin(void) {
+    replay_arena = list_arena_create(0);
+}
+
+static void arena_end(void) {
+    list_arena_destroy(replay_arena);
+    replay_arena = NULL;
+}
+
+static void *arena_create(void) {
+    return list_create_in_arena(replay_arena);
+}
+
+// ListDeque, inserts and removes away from the ends shift the elements over
+
+typedef struct DequeIterator {
+    ListDeque * deque;
+    size_t position;
+} DequeIterator;
+
+static void *deque_create(void) {
+    return list_deque_create();
+}
+
+static void deque_destroy(void *deque) {
+    list_deque_destroy(deque, NULL);
+}
+
+static int deque_add(void *deque, void *data) {
+    return list_deque_push_back(deque, data);
+}
+
+static int deque_insert_at(void *deque, size_t index, void *data) {
+    size_t size = list_deque_size(deque);
+    if (index > size) return -1;
+    if (index == 0) return list_deque_push_front(deque, data);
+    if (list_deque_push_back(deque, data) != 0) return -1;
+    for (size_t i = size; i > index; i--) {
+        void * moved;
+        list_deque_get_at(deque, i - 1, &moved);
+        list_deque_set_at(deque, i, moved);
+    }
+    return list_deque_set_at(deque, index, data);
+}
+
+static int deque_get_at(void *deque, size_t index, void **out_data) {
+    return list_deque_get_at(deque, index, out_data);
+}
+
+static int deque_remove_at(void *deque, size_t index, void **out_data) {
+    size_t size = list_deque_size(deque);
+    if (index >= size) return -1;
+    if (index == 0) return list_deque_pop_front(deque, out_data);
+    list_deque_get_at(deque, index, out_data);
+    for (size_t i = index; i + 1 < size; i++) {
+        void * moved;
+        list_deque_get_at(deque, i + 1, &moved);
+        list_deque_set_at(deque, i, moved);
+    }
+    void * last;
+    return list_deque_pop_back(deque, &last);
+}
+
+static int compare_int_pointers(const void *a, const void *b) {
+    return compare_ints(*(void *const *)a, *(void *const *)b);
+}
+
+static void deque_sort(void *deque) {
+    size_t size = list_deque_size(deque);
+    void ** items = malloc(size * sizeof(void *));
+    if (items == NULL) return;
+    for (size_t i = 0; i < size; i++) {
+        list_deque_get_at(deque, i, &items[i]);
+    }
+    qsort(items, size, sizeof(void *), compare_int_pointers);
+    for (size_t i = 0; i < size; i++) {
+        list_deque_set_at(deque, i, items[i]);
+    }
+    free(items);
+}
+
+static void *deque_iterator_create(void *deque) {
+    DequeIterator * iter = malloc(sizeof(DequeIterator));
+    if (iter == NULL) return NULL;
+    iter->deque = deque;
+    iter->position = 0;
+    return iter;
+}
+
+static int deque_iterator_next(void *iter, void **out_data) {
+    DequeIterator * deque_iter = iter;
+    if (list_deque_get_at(deque_iter->deque, deque_iter->position, out_data) != 0) return 0;
+    deque_iter->position++;
+    return 1;
+}
+
+static void deque_iterator_reset(void *iter) {
+    ((DequeIterator *)iter)->position = 0;
+}
+
+static void deque_iterator_destroy(void *iter) {
+    free(iter);
+}
+
+static const ReplayEngine engines[] = {
+    {"list", NULL, NULL, linked_create, linked_destroy, linked_add, linked_insert_at, linked_get_at,
+     linked_remove_at, linked_sort, linked_iterator_create, linked_iterator_next, linked_iterator_reset,
+     linked_iterator_destroy},
+    {"arena", arena_begin, arena_end, arena_create, linked_destroy, linked_add, linked_insert_at, linked_get_at,
+     linked_remove_at, linked_sort, linked_iterator_create, linked_iterator_next, linked_iterator_reset,
+     linked_iterator_destroy},
+    {"deque", NULL, NULL, deque_create, deque_destroy, deque_add, deque_insert_at, deque_get_at,
+     deque_remove_at, deque_sort, deque_iterator_create, deque_iterator_next, deque_iterator_reset,
+     deque_iterator_destroy},
+};
+#define ENGINE_COUNT (sizeof(engines) / sizeof(engines[0]))
+
+// Reads a whole trace and works out which lists have to exist before it starts
+// returns 0 on success, -1 on failure
+static int load_trace(const char *path, ReplayTrace *trace) {
+    memset(trace, 0, sizeof(ReplayTrace));
+    FILE * in = fopen(path, "rb");
+    if (in == NULL) return -1;
+    if (list_record_read_header(in) != 0) {
+        fclose(in);
+        return -1;
+    }
+
+    size_t capacity = 0;
+    ListRecordEntry entry;
+    int status;
+    while ((status = list_record_read(in, &entry)) == 1) {
+        if (trace->count == capacity) {
+            capacity = capacity == 0 ? 4096 : capacity * 2;
+            ListRecordEntry * entries = realloc(trace->entries, capacity * sizeof(ListRecordEntry));
+            if (entries == NULL) {
+                status = -1;
+                break;
+            }
+            trace->entries = entries;
+        }
+        trace->entries[trace->count++] = entry;
+        if (entry.list > trace->max_list) trace->max_list = (size_t)entry.list;
+        if (entry.op >= LIST_RECORD_ITERATOR_CREATE && entry.arg > trace->max_iterator) {
+            trace->max_iterator = (size_t)entry.arg;
+        }
+    }
+    fclose(in);
+    if (status != 0) return -1;
+
+    // a list that first shows up with anything but its creation existed before recording started
+    trace->prebuilt = calloc(trace->max_list + 1, sizeof(uint64_t));
+    unsigned char * seen = calloc(trace->max_list + 1, 1);
+    if (trace->prebuilt == NULL || seen == NULL) {
+        free(seen);
+        return -1;
+    }
+    for (size_t i = 0; i < trace->count; i++) {
+        const ListRecordEntry * current = &trace->entries[i];
+        if (current->list == 0) continue;
+        if (current->op == LIST_RECORD_ADD || current->op == LIST_RECORD_INSERT_AT) trace->element_count++;
+        if (seen[current->list]) continue;
+        seen[current->list] = 1;
+        if (current->op != LIST_RECORD_CREATE) {
+            trace->prebuilt[current->list] = current->size + 1;
+            trace->element_count += (size_t)current->size;
+        }
+    }
+    free(seen);
+    return 0;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Runs the trace against engine
+// returns 0 on success, -1 if the replay could not be set up
+static int replay(const ReplayTrace *trace, const ReplayEngine *engine, ReplayResult *result) {
+    void ** lists = calloc(trace->max_list + 1, sizeof(void *));
+    void ** iterators = calloc(trace->max_iterator + 1, sizeof(void *));
+    if (lists == NULL || iterators == NULL) {
+        free(lists);
+        free(iterators);
+        return -1;
+    }
+    if (engine->begin != NULL) engine->begin();
+    pool_used = 0;
+    result->failed = 0;
+
+    for (size_t id = 1; id <= trace->max_list; id++) {
+        if (trace->prebuilt[id] == 0) continue;
+        lists[id] = engine->create();
+        for (uint64_t i = 1; i < trace->prebuilt[id] && lists[id] != NULL; i++) {
+            engine->add(lists[id], next_element());
+        }
+    }
+
+    double start = now_seconds();
+    for (size_t i = 0; i < trace->count; i++) {
+        const ListRecordEntry * entry = &trace->entries[i];
+        void * list = lists[entry->list];
+        void ** iterator = entry->op >= LIST_RECORD_ITERATOR_CREATE ? &iterators[entry->arg] : NULL;
+        void * data;
+        int failed = 0;
+
+        // calls on lists that are gone (or never made it) are counted as failed
+        if (list == NULL && entry->op != LIST_RECORD_CREATE && entry->op != LIST_RECORD_ITERATOR_DESTROY &&
+            !(iterator != NULL && *iterator != NULL)) {
+            result->failed++;
+            continue;
+        }
+        switch (entry->op) {
+            case LIST_RECORD_CREATE:
+                if (list != NULL) engine->destroy(list);
+                lists[entry->list] = engine->create();
+                failed = lists[entry->list] == NULL;
+                break;
+            case LIST_RECORD_DESTROY:
+                engine->destroy(list);
+                lists[entry->list] = NULL;
+                break;
+            case LIST_RECORD_ADD:
+                failed = engine->add(list, next_element()) != 0;
+                break;
+            case LIST_RECORD_INSERT_AT:
+                failed = engine->insert_at(list, (size_t)entry->arg, next_element()) != 0;
+                break;
+            case LIST_RECORD_GET_AT:
+                failed = engine->get_at(list, (size_t)entry->arg, &data) != 0;
+                break;
+            case LIST_RECORD_REMOVE_AT:
+                failed = engine->remove_at(list, (size_t)entry->arg, &data) != 0;
+                break;
+            case LIST_RECORD_MERGE_SORT:
+                engine->sort(list);
+                break;
+            case LIST_RECORD_ITERATOR_CREATE:
+                if (*iterator != NULL) engine->iterator_destroy(*iterator);
+                *iterator = engine->iterator_create(list);
+                failed = *iterator == NULL;
+                break;
+            case LIST_RECORD_ITERATOR_NEXT:
+                // iterators made before recording started show up here first
+                if (*iterator == NULL) *iterator = engine->iterator_create(list);
+                failed = *iterator == NULL || engine->iterator_next(*iterator, &data) < 0;
+                break;
+            case LIST_RECORD_ITERATOR_RESET:
+                if (*iterator == NULL) *iterator = engine->iterator_create(list);
+                if (*iterator != NULL) engine->iterator_reset(*iterator);
+                failed = *iterator == NULL;
+                break;
+            case LIST_RECORD_ITERATOR_DESTROY:
+                if (*iterator != NULL) engine->iterator_destroy(*iterator);
+                *iterator = NULL;
+                break;
+            default:
+                failed = 1;
+                break;
+        }
+        result->failed += (size_t)failed;
+    }
+    result->seconds = now_seconds() - start;
+
+    for (size_t id = 0; id <= trace->max_iterator; id++) {
+        if (iterators[id] != NULL) engine->iterator_destroy(iterators[id]);
+    }
+    for (size_t id = 0; id <= trace->max_list; id++) {
+        if (lists[id] != NULL) engine->destroy(lists[id]);
+    }
+    if (engine->end != NULL) engine->end();
+    free(iterators);
+    free(lists);
+    return 0;
+}
+
+#if defined(REPLAY_FORK)
+// Reads a "Vm...:   1234 kB" line of /proc/self/status
+// returns the value in kB, 0 if it could not be read
+static size_t status_kb(const char *field) {
+    FILE * status = fopen("/proc/self/status", "r");
+    if (status == NULL) return 0;
+    char line[256];
+    size_t value = 0;
+    size_t length = strlen(field);
+    while (fgets(line, sizeof(line), status) != NULL) {
+        if (strncmp(line, field, length) == 0 && line[length] == ':') {
+            value = (size_t)strtoull(line + length + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(status);
+    return value;
+}
+#endif
+
+// Replays the trace against engine and prints a line for it
+static void run_engine(const ReplayTrace *trace, const ReplayEngine *engine) {
+    ReplayResult result;
+#if defined(REPLAY_FORK)
+    fflush(stdout);
+    pid_t child = fork();
+    if (child > 0) {
+        int status;
+        waitpid(child, &status, 0);
+        return;
+    }
+    // what the child starts out with is the parent's, only the growth counts
+    size_t base_kb = status_kb("VmRSS");
+#endif
+
+    if (replay(trace, engine, &result) != 0) {
+        printf("%-8s could not be set up\n", engine->name);
+    } else {
+        printf("%-8s %12.6f %12.2f", engine->name, result.seconds,
+               trace->count > 0 ? result.seconds * 1e9 / (double)trace->count : 0.0);
+#if defined(REPLAY_FORK)
+        size_t peak_kb = status_kb("VmHWM");
+        printf(" %12.1f", peak_kb > base_kb ? (double)(peak_kb - base_kb) / 1024.0 : 0.0);
+#else
+        printf(" %12s", "n/a");
+#endif
+        printf(" %10zu\n", result.failed);
+    }
+
+#if defined(REPLAY_FORK)
+    if (child == 0) {
+        fflush(stdout);
+        _exit(0);
+    }
+#endif
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s trace [variant...]\nvariants:", argv[0]);
+        for (size_t i = 0; i < ENGINE_COUNT; i++) {
+            fprintf(stderr, " %s", engines[i].name);
+        }
+        fprintf(stderr, "\n");
+        return 1;
+    }
+
+    ReplayTrace trace;
+    if (load_trace(argv[1], &trace) != 0) {
+        fprintf(stderr, "%s: cannot read trace %s\n", argv[0], argv[1]);
+        free(trace.entries);
+        free(trace.prebuilt);
+        return 1;
+    }
+    pool = malloc((trace.element_count + 1) * sizeof(int));
+    if (pool == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    // scrambled so sorts have work to do, the same for every variant
+    uint32_t state = 1;
+    for (size_t i = 0; i < trace.element_count; i++) {
+        state = state * 1664525u + 1013904223u;
+        pool[i] = (int)(state >> 1);
+    }
+
+    printf("%zu calls on %zu lists\n", trace.count, trace.max_list);
+    printf("%-8s %12s %12s %12s %10s\n", "variant", "seconds", "ns/call", "peak MB", "failed");
+    int status = 0;
+    for (size_t i = 0; i < ENGINE_COUNT; i++) {
+        int selected = argc == 2;
+        for (int arg = 2; arg < argc; arg++) {
+            if (strcmp(argv[arg], engines[i].name) == 0) selected = 1;
+        }
+        if (selected) run_engine(&trace, &engines[i]);
+    }
+    for (int arg = 2; arg < argc; arg++) {
+        int known = 0;
+        for (size_t i = 0; i < ENGINE_COUNT; i++) {
+            if (strcmp(argv[arg], engines[i].name) == 0) known = 1;
+        }
+        if (!known) {
+            fprintf(stderr, "%s: unknown variant %s\n", argv[0], argv[arg]);
+            status = 1;
+        }
+    }
+
+    free(pool);
+    free(trace.prebuilt);
+    free(trace.entries);
+    return status;
+}
@@ -0,0 +1,1669 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include "linked_list.h"
+
+// Tests for the list library, run by ctest.
+//
+// A model-based test drives lists with random operations and checks them
+// against a plain array after every step, then every feature gets a targeted
+// test of its own. Builds that wrap malloc (see CMakeLists.txt) also make
+// allocations fail one after the other to check that failing calls leave
+// everything as it was.
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+// Small deterministic random numbers, so a failing run can be repeated
+static uint64_t rng_state = 1;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// Returns a random number below bound, which must not be 0
+static size_t rng_below(size_t bound) {
+    return (size_t)(rng_next() % bound);
+}
+
+// Most tests store plain numbers in the data pointers
+#define VAL(x) ((void *)(uintptr_t)(x))
+#define NUM(p) ((uintptr_t)(p))
+
+static size_t hash_value(const void *data) {
+    return (size_t)(NUM(data) * UINT64_C(0x9E3779B97F4A7C15));
+}
+
+static int equal_values(const void *a, const void *b) {
+    return a == b;
+}
+
+static int compare_values(const void *a, const void *b) {
+    return (NUM(a) > NUM(b)) - (NUM(a) < NUM(b));
+}
+
+static uint64_t value_key(const void *data) {
+    return NUM(data);
+}
+
+// Counts the elements a destroy or a pipeline hands to it, and adds them up
+static size_t freed_count = 0;
+static uintptr_t freed_sum = 0;
+
+static void count_free(void *data) {
+    freed_count++;
+    freed_sum += NUM(data);
+}
+
+// Checks that the list holds exactly the n values, in order
+static int list_equals(LinkedList *list, const uintptr_t *values, size_t n) {
+    if (list_size(list) != n) return 0;
+    ListIterator * iter = list_iterator_create(list);
+    if (iter == NULL) return 0;
+    int equal = 1;
+    void * data;
+    for (size_t i = 0; i < n; i++) {
+        if (list_iterator_next(iter, &data) != 1 || NUM(data) != values[i]) {
+            equal = 0;
+            break;
+        }
+    }
+    if (equal && list_iterator_next(iter, &data) != 0) equal = 0;
+    list_iterator_destroy(iter);
+    return equal;
+}
+
+// Builds a list of the n values, in the arena if there is one
+static LinkedList *list_of(ListArena *arena, const uintptr_t *values, size_t n) {
+    LinkedList * list = arena != NULL ? list_create_in_arena(arena) : list_create();
+    if (list == NULL) return NULL;
+    for (size_t i = 0; i < n; i++) {
+        if (list_add(list, VAL(values[i])) != 0) {
+            list_destroy(list, NULL);
+            return NULL;
+        }
+    }
+    return list;
+}
+
+// Model-based test
+
+#define MODEL_MAX 300
+#define MODEL_SNAPSHOTS 4
+#define MODEL_REMOVED 64
+
+// What the list under test should look like
+typedef struct Model {
+    uintptr_t values[MODEL_MAX];
+    // handle to the element at the same position, 0 when it has none
+    ListHandle handles[MODEL_MAX];
+    size_t size;
+} Model;
+
+typedef struct ModelRun {
+    LinkedList * list;
+    Model model;
+    LinkedList * snapshots[MODEL_SNAPSHOTS];
+    Model snapshot_models[MODEL_SNAPSHOTS];
+    size_t snapshot_count;
+    // values of the elements removed last
+    uintptr_t removed[MODEL_REMOVED];
+    // and the handles they had
+    ListHandle stale[MODEL_REMOVED];
+    size_t removed_count;
+    int indexed;
+    uintptr_t next_value;
+} ModelRun;
+
+static void model_insert(Model *model, size_t index, uintptr_t value) {
+    memmove(&model->values[index + 1], &model->values[index], (model->size - index) * sizeof(uintptr_t));
+    model->values[index] = value;
+    memmove(&model->handles[index + 1], &model->handles[index], (model->size - index) * sizeof(ListHandle));
+    model->handles[index] = 0;
+    model->size++;
+}
+
+// Takes the element at index out of the model and remembers it as removed
+static void model_remove(ModelRun *run, size_t index) {
+    Model * model = &run->model;
+    size_t slot = run->removed_count++ % MODEL_REMOVED;
+    run->removed[slot] = model->values[index];
+    run->stale[slot] = model->handles[index];
+    memmove(&model->handles[index], &model->handles[index + 1], (model->size - index - 1) * sizeof(ListHandle));
+    memmove(&model->values[index], &model->values[index + 1], (model->size - index - 1) * sizeof(uintptr_t));
+    model->size--;
+}
+
+// Sorts the model the way list_merge_sort sorts the list, handles move along
+static void model_sort(Model *model) {
+    for (size_t i = 1; i < model->size; i++) {
+        uintptr_t value = model->values[i];
+        ListHandle handle = model->handles[i];
+        size_t j = i;
+        while (j > 0 && model->values[j - 1] > value) {
+            model->values[j] = model->values[j - 1];
+            model->handles[j] = model->handles[j - 1];
+            j--;
+        }
+        model->values[j] = value;
+        model->handles[j] = handle;
+    }
+}
+
+// Finds a random element that has a handle
+// returns its index, or the model size if none has one
+static size_t model_pick_handle(const Model *model) {
+    if (model->size == 0) return 0;
+    size_t start = rng_below(model->size);
+    for (size_t i = 0; i < model->size; i++) {
+        size_t index = (start + i) % model->size;
+        if (model->handles[index] != 0) return index;
+    }
+    return model->size;
+}
+
+// Checks everything the list promises against the model
+static void model_verify(ModelRun *run) {
+    Model * model = &run->model;
+    CHECK(list_equals(run->list, model->values, model->size));
+    for (size_t i = 0; i < model->size; i++) {
+        void * data;
+        if (model->handles[i] != 0) {
+            CHECK(list_get_handle(run->list, model->handles[i], &data) == 0 && NUM(data) == model->values[i]);
+        }
+        if (run->indexed) {
+            CHECK(list_find(run->list, VAL(model->values[i]), &data) == 0 && NUM(data) == model->values[i]);
+        }
+    }
+    size_t removed = run->removed_count < MODEL_REMOVED ? run->removed_count : MODEL_REMOVED;
+    for (size_t i = 0; i < removed; i++) {
+        void * data;
+        if (run->stale[i] != 0) CHECK(list_get_handle(run->list, run->stale[i], &data) == -1);
+        if (run->indexed) CHECK(!list_contains(run->list, VAL(run->removed[i])));
+    }
+    if (model->size > 0) {
+        void * data;
+        size_t index = rng_below(model->size);
+        CHECK(list_get_at(run->list, index, &data) == 0 && NUM(data) == model->values[index]);
+    }
+    void * data;
+    CHECK(list_get_at(run->list, model->size, &data) == -1);
+
+    // snapshots keep showing what the list held when they were taken
+    for (size_t i = 0; i < run->snapshot_count; i++) {
+        Model * snapshot_model = &run->snapshot_models[i];
+        CHECK(list_equals(run->snapshots[i], snapshot_model->values, snapshot_model->size));
+        CHECK(list_add(run->snapshots[i], VAL(1)) == -1);
+        CHECK(list_remove_at(run->snapshots[i], 0, &data) == -1);
+    }
+}
+
+// Makes one random call on the list and the same change to the model
+static void model_step(ModelRun *run) {
+    Model * model = &run->model;
+    LinkedList * list = run->list;
+    void * data;
+    ListHandle handle;
+    size_t index;
+    size_t op = rng_below(14);
+    // keep the size bounded
+    if (model->size >= MODEL_MAX && op <= 4) op = 5;
+
+    switch (op) {
+        case 0:
+        case 1:
+            CHECK(list_add(list, VAL(run->next_value)) == 0);
+            model_insert(model, model->size, run->next_value++);
+            break;
+        case 2:
+            index = rng_below(model->size + 1);
+            CHECK(list_insert_at(list, index, VAL(run->next_value)) == 0);
+            model_insert(model, index, run->next_value++);
+            break;
+        case 3:
+            CHECK(list_add_with_handle(list, VAL(run->next_value), &handle) == 0 && handle != 0);
+            model_insert(model, model->size, run->next_value++);
+            model->handles[model->size - 1] = handle;
+            break;
+        case 4:
+            index = rng_below(model->size + 1);
+            CHECK(list_insert_at_with_handle(list, index, VAL(run->next_value), &handle) == 0 && handle != 0);
+            model_insert(model, index, run->next_value++);
+            model->handles[index] = handle;
+            break;
+        case 5:
+        case 6:
+            if (model->size == 0) {
+                CHECK(list_remove_at(list, 0, &data) == -1);
+                break;
+            }
+            index = rng_below(model->size);
+            CHECK(list_remove_at(list, index, &data) == 0 && NUM(data) == model->values[index]);
+            model_remove(run, index);
+            break;
+        case 7:
+            index = model_pick_handle(model);
+            if (index == model->size) break;
+            CHECK(list_remove_handle(list, model->handles[index], &data) == 0 && NUM(data) == model->values[index]);
+            model_remove(run, index);
+            break;
+        case 8:
+            index = model_pick_handle(model);
+            if (index == model->size || model->size >= MODEL_MAX) break;
+            CHECK(list_insert_after_handle(list, model->handles[index], VAL(run->next_value), &handle) == 0);
+            model_insert(model, index + 1, run->next_value++);
+            model->handles[index + 1] = handle;
+            break;
+        case 9:
+            if (model->size == 0) {
+                CHECK(list_handle_at(list, 0, &handle) == -1);
+                break;
+            }
+            index = rng_below(model->size);
+            CHECK(list_handle_at(list, index, &handle) == 0);
+            CHECK(model->handles[index] == 0 || model->handles[index] == handle);
+            model->handles[index] = handle;
+            break;
+        case 10:
+            if (run->snapshot_count == MODEL_SNAPSHOTS) break;
+            run->snapshots[run->snapshot_count] = list_snapshot(list);
+            CHECK(run->snapshots[run->snapshot_count] != NULL);
+            if (run->snapshots[run->snapshot_count] == NULL) break;
+            run->snapshot_models[run->snapshot_count] = *model;
+            run->snapshot_count++;
+            break;
+        case 11:
+            if (run->snapshot_count == 0) break;
+            index = rng_below(run->snapshot_count);
+            list_destroy(run->snapshots[index], NULL);
+            run->snapshots[index] = run->snapshots[run->snapshot_count - 1];
+            run->snapshot_models[index] = run->snapshot_models[run->snapshot_count - 1];
+            run->snapshot_count--;
+            break;
+        case 12:
+            // sorting only shuffles values around when there are some out of order
+            if (rng_below(8) != 0) break;
+            list_merge_sort(list, compare_values);
+            model_sort(model);
+            break;
+        default:
+            if (model->size == 0) break;
+            index = rng_below(model->size);
+            CHECK(list_get_at(list, index, &data) == 0 && NUM(data) == model->values[index]);
+            break;
+    }
+}
+
+static void run_model(ListArena *arena, int indexed, uint64_t seed, size_t steps) {
+    static ModelRun run;
+    memset(&run, 0, sizeof(run));
+    rng_state = seed;
+    run.list = arena != NULL ? list_create_in_arena(arena) : list_create();
+    CHECK(run.list != NULL);
+    if (run.list == NULL) return;
+    run.next_value = 1;
+    run.indexed = indexed;
+    if (indexed) CHECK(list_index_enable(run.list, hash_value, equal_values) == 0);
+
+    for (size_t step = 0; step < steps; step++) {
+        // values are handed out in rising order, jump around now and then so sorts
+        // move things, every stretch gets its own range so values stay unique
+        if (step % 97 == 0) run.next_value = (rng_below(1000) * 1000 + step / 97) * 1000 + 1;
+        model_step(&run);
+        model_verify(&run);
+    }
+
+    for (size_t i = 0; i < run.snapshot_count; i++) {
+        list_destroy(run.snapshots[i], NULL);
+    }
+    list_destroy(run.list, NULL);
+}
+
+static void test_model(void) {
+    for (uint64_t seed = 1; seed <= 4; seed++) {
+        run_model(NULL, 0, seed, 1500);
+        run_model(NULL, 1, seed * 7919, 1500);
+    }
+    ListArena * arena = list_arena_create(4096);
+    CHECK(arena != NULL);
+    if (arena == NULL) return;
+    for (uint64_t seed = 1; seed <= 2; seed++) {
+        run_model(arena, (int)(seed % 2), seed * 104729, 1500);
+        list_arena_reset(arena);
+    }
+    list_arena_destroy(arena);
+}
+
+// Targeted tests
+
+static void test_arena(void) {
+    ListArena * arena = list_arena_create(256);
+    CHECK(arena != NULL);
+    if (arena == NULL) return;
+
+    uintptr_t values[100];
+    for (int round = 0; round < 3; round++) {
+        // several lists share the arena, and go away together with a reset
+        LinkedList * lists[4];
+        for (size_t i = 0; i < 4; i++) {
+            for (size_t j = 0; j < 100; j++) values[j] = i * 1000 + j;
+            lists[i] = list_of(arena, values, 100);
+            CHECK(lists[i] != NULL);
+            if (lists[i] == NULL) return;
+        }
+        void * data;
+        CHECK(list_remove_at(lists[2], 50, &data) == 0 && NUM(data) == 2050);
+        CHECK(list_insert_at(lists[2], 0, VAL(7)) == 0);
+        CHECK(list_size(lists[2]) == 100);
+        for (size_t j = 0; j < 100; j++) values[j] = 3000 + j;
+        CHECK(list_equals(lists[3], values, 100));
+        // destroying an arena list without a free function gives nothing back
+        list_destroy(lists[0], NULL);
+        list_arena_reset(arena);
+    }
+
+    // allocations bigger than a block still work, and are aligned for any type
+    void * big = list_arena_alloc(arena, 4096);
+    CHECK(big != NULL && NUM(big) % sizeof(void *) == 0);
+    if (big != NULL) memset(big, 0xab, 4096);
+    list_arena_destroy(arena);
+}
+
+static void test_merge(void) {
+    uintptr_t evens[50];
+    uintptr_t odds[50];
+    uintptr_t all[100];
+    for (uintptr_t i = 0; i < 50; i++) {
+        evens[i] = 2 * i;
+        odds[i] = 2 * i + 1;
+    }
+    for (uintptr_t i = 0; i < 100; i++) all[i] = i;
+
+    LinkedList * a = list_of(NULL, evens, 50);
+    LinkedList * b = list_of(NULL, odds, 50);
+    CHECK(a != NULL && b != NULL);
+    if (a == NULL || b == NULL) return;
+    CHECK(list_merge(a, b, compare_values) == 0);
+    CHECK(list_equals(a, all, 100) && list_size(b) == 0);
+    // src stays usable
+    CHECK(list_add(b, VAL(5)) == 0 && list_size(b) == 1);
+    list_destroy(b, NULL);
+
+    LinkedList * lists[3];
+    lists[0] = list_of(NULL, evens, 50);
+    lists[1] = a;
+    lists[2] = list_of(NULL, odds, 50);
+    CHECK(lists[0] != NULL && lists[2] != NULL);
+    if (lists[0] == NULL || lists[2] == NULL) return;
+    CHECK(list_merge_k(lists, 3, compare_values) == 0);
+    CHECK(list_size(lists[0]) == 200 && list_size(lists[1]) == 0 && list_size(lists[2]) == 0);
+    for (size_t i = 1; i < 200; i++) {
+        void * left;
+        void * right;
+        CHECK(list_get_at(lists[0], i - 1, &left) == 0 && list_get_at(lists[0], i, &right) == 0);
+        CHECK(NUM(left) <= NUM(right));
+    }
+    for (size_t i = 0; i < 3; i++) list_destroy(lists[i], NULL);
+}
+
+// Heap allocated records with keys that repeat, numbered in their original order
+typedef struct Record {
+    int key;
+    int seq;
+} Record;
+
+static int compare_records(const void *a, const void *b) {
+    const Record * x = a;
+    const Record * y = b;
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+static int write_record(const void *data, FILE *out, void *ctx) {
+    (void)ctx;
+    return fwrite(data, sizeof(Record), 1, out) == 1 ? 0 : -1;
+}
+
+static void *read_record(FILE *in, void *ctx) {
+    (void)ctx;
+    Record * record = malloc(sizeof(Record));
+    if (record != NULL && fread(record, sizeof(Record), 1, in) != 1) {
+        free(record);
+        return NULL;
+    }
+    return record;
+}
+
+static size_t record_size(const void *data, void *ctx) {
+    (void)data;
+    (void)ctx;
+    return sizeof(Record);
+}
+
+// Builds a list of n records with keys that repeat, numbered in order
+static LinkedList *record_list(size_t n) {
+    LinkedList * list = list_create();
+    if (list == NULL) return NULL;
+    for (size_t i = 0; i < n; i++) {
+        Record * record = malloc(sizeof(Record));
+        if (record == NULL || list_add(list, record) != 0) {
+            free(record);
+            list_destroy(list, free);
+            return NULL;
+        }
+        record->key = (int)((i * 7919) % (n / 4 + 1));
+        record->seq = (int)i;
+    }
+    return list;
+}
+
+// Checks that the list is stably sorted by key and holds every record once
+static int records_sorted(LinkedList *list, size_t n) {
+    if (list_size(list) != n) return 0;
+    char * seen = calloc(n, 1);
+    if (seen == NULL) return 0;
+    ListIterator * iter = list_iterator_create(list);
+    const Record * prev = NULL;
+    int sorted = iter != NULL;
+    void * data;
+    while (sorted && list_iterator_next(iter, &data) == 1) {
+        const Record * record = data;
+        if (record->seq < 0 || (size_t)record->seq >= n || seen[record->seq]) sorted = 0;
+        else seen[record->seq] = 1;
+        if (prev != NULL && (prev->key > record->key || (prev->key == record->key && prev->seq > record->seq))) sorted = 0;
+        prev = record;
+    }
+    list_iterator_destroy(iter);
+    free(seen);
+    return sorted;
+}
+
+// Checks that the list holds every record once, in any order
+static int records_complete(LinkedList *list, size_t n) {
+    if (list_size(list) != n) return 0;
+    char * seen = calloc(n, 1);
+    if (seen == NULL) return 0;
+    ListIterator * iter = list_iterator_create(list);
+    int complete = iter != NULL;
+    void * data;
+    while (complete && list_iterator_next(iter, &data) == 1) {
+        const Record * record = data;
+        if (record->seq < 0 || (size_t)record->seq >= n || seen[record->seq]) complete = 0;
+        else seen[record->seq] = 1;
+    }
+    list_iterator_destroy(iter);
+    free(seen);
+    return complete;
+}
+
+typedef struct SinkState {
+    size_t count;
+    Record last;
+    int sorted;
+} SinkState;
+
+static int sink_record(void *data, void *ctx) {
+    SinkState * state = ctx;
+    Record * record = data;
+    if (state->count > 0 && (state->last.key > record->key ||
+                             (state->last.key == record->key && state->last.seq > record->seq))) {
+        state->sorted = 0;
+    }
+    state->last = *record;
+    state->count++;
+    free(record);
+    return 0;
+}
+
+static void test_external_sort(void) {
+    ListSerializer serializer = {write_record, read_record, record_size, free, NULL};
+    size_t n = 5000;
+
+    // small budget, so the list goes to disk in many runs
+    LinkedList * list = record_list(n);
+    CHECK(list != NULL);
+    if (list == NULL) return;
+    CHECK(list_external_sort(list, compare_records, &serializer, 8192, NULL) == 0);
+    CHECK(records_sorted(list, n));
+    list_destroy(list, free);
+
+    // a budget the whole list fits in sorts it in memory
+    list = record_list(n);
+    CHECK(list != NULL);
+    if (list == NULL) return;
+    CHECK(list_external_sort(list, compare_records, &serializer, (size_t)1 << 26, NULL) == 0);
+    CHECK(records_sorted(list, n));
+    list_destroy(list, free);
+
+    // streaming to a sink leaves the list empty
+    list = record_list(n);
+    CHECK(list != NULL);
+    if (list == NULL) return;
+    SinkState state = {0, {0, 0}, 1};
+    CHECK(list_external_sort_to(list, compare_records, &serializer, 8192, NULL, sink_record, &state) == 0);
+    CHECK(state.count == n && state.sorted && list_size(list) == 0);
+    list_destroy(list, free);
+
+    // a tmpdir that cannot be written to fails, and the list keeps all of its elements
+    list = record_list(n);
+    CHECK(list != NULL);
+    if (list == NULL) return;
+    CHECK(list_external_sort(list, compare_records, &serializer, 8192, "/nonexistent/list_tests") == -1);
+    CHECK(records_complete(list, n));
+    // a budget smaller than a single element cannot work
+    CHECK(list_external_sort(list, compare_records, &serializer, 8, NULL) == -1);
+    CHECK(records_complete(list, n));
+    list_destroy(list, free);
+}
+
+#define SORT_COUNT 1000
+
+// Records with random keys, and their addresses in the original and the stably sorted order
+static Record sort_records[SORT_COUNT];
+static uintptr_t sort_original[SORT_COUNT];
+static uintptr_t sort_expected[SORT_COUNT];
+
+static int compare_record_pointers(const void *a, const void *b) {
+    const Record * x = *(const Record * const *)a;
+    const Record * y = *(const Record * const *)b;
+    int order = compare_records(x, y);
+    return order != 0 ? order : (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+static void sort_fixture(void) {
+    static Record * sorted[SORT_COUNT];
+    rng_state = 42;
+    for (size_t i = 0; i < SORT_COUNT; i++) {
+        sort_records[i].key = (int)rng_below(100);
+        sort_records[i].seq = (int)i;
+        sorted[i] = &sort_records[i];
+    }
+    qsort(sorted, SORT_COUNT, sizeof(Record *), compare_record_pointers);
+    for (size_t i = 0; i < SORT_COUNT; i++) {
+        sort_original[i] = (uintptr_t)&sort_records[i];
+        sort_expected[i] = (uintptr_t)sorted[i];
+    }
+}
+
+static void test_partial_sort(void) {
+    sort_fixture();
+    LinkedList * list = list_of(NULL, sort_original, SORT_COUNT);
+    CHECK(list != NULL);
+    if (list == NULL) return;
+
+    // nth_element leaves the list alone
+    void * nth;
+    CHECK(list_nth_element(list, 500, compare_records, &nth) == 0);
+    CHECK(((Record *)nth)->key == ((Record *)sort_expected[500])->key);
+    CHECK(list_nth_element(list, SORT_COUNT, compare_records, &nth) == -1);
+    CHECK(list_equals(list, sort_original, SORT_COUNT));
+
+    // partial sort puts the 50 smallest up front, the rest keeps its order
+    CHECK(list_partial_sort(list, 50, compare_records) == 0);
+    void * data;
+    for (size_t i = 0; i < 50; i++) {
+        CHECK(list_get_at(list, i, &data) == 0 && NUM(data) == sort_expected[i]);
+    }
+    const Record * prev = NULL;
+    for (size_t i = 50; i < SORT_COUNT; i++) {
+        CHECK(list_get_at(list, i, &data) == 0);
+        const Record * record = data;
+        CHECK(prev == NULL || prev->seq < record->seq);
+        prev = record;
+    }
+
+    // a k past the end sorts everything
+    CHECK(list_partial_sort(list, SORT_COUNT * 2, compare_records) == 0);
+    CHECK(list_equals(list, sort_expected, SORT_COUNT));
+    list_destroy(list, NULL);
+}
+
+static void test_sorted_iterator(void) {
+    sort_fixture();
+    LinkedList * list = list_of(NULL, sort_original, SORT_COUNT);
+    CHECK(list != NULL);
+    if (list == NULL) return;
+    ListIterator * iter = list_sorted_iterator_create(list, compare_records);
+    CHECK(iter != NULL);
+    if (iter != NULL) {
+        void * data;
+        size_t count = 0;
+        while (count < SORT_COUNT && list_iterator_next(iter, &data) == 1) {
+            CHECK(NUM(data) == sort_expected[count]);
+            count++;
+        }
+        CHECK(count == SORT_COUNT && list_iterator_next(iter, &data) == 0);
+        // a reset starts over
+        list_iterator_reset(iter);
+        CHECK(list_iterator_next(iter, &data) == 1 && NUM(data) == sort_expected[0]);
+        list_iterator_destroy(iter);
+    }
+    CHECK(list_equals(list, sort_original, SORT_COUNT));
+    list_destroy(list, NULL);
+}
+
+static int keep_even(const void *data, void *ctx) {
+    (void)ctx;
+    return NUM(data) % 2 == 0;
+}
+
+static int keep_multiple_of_20(const void *data, void *ctx) {
+    (void)ctx;
+    return NUM(data) % 20 == 0;
+}
+
+static void *times_ten(void *data, void *ctx) {
+    (void)ctx;
+    return VAL(NUM(data) * 10);
+}
+
+static void *sum_values(void *acc, void *data, void *ctx) {
+    (void)ctx;
+    return VAL(NUM(acc) + NUM(data));
+}
+
+static void test_pipeline(void) {
+    uintptr_t values[10] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    LinkedList * list = list_of(NULL, values, 10);
+    ListPipeline * pipeline = list_pipeline_create();
+    CHECK(list != NULL && pipeline != NULL);
+    if (list == NULL || pipeline == NULL) return;
+
+    CHECK(list_pipeline_filter(pipeline, keep_even, NULL) == 0);
+    CHECK(list_pipeline_map(pipeline, times_ten, NULL) == 0);
+    CHECK(list_pipeline_reduce(pipeline, sum_values, VAL(0), NULL) == 0);
+    // nothing goes after the reduce
+    CHECK(list_pipeline_map(pipeline, times_ten, NULL) == -1);
+
+    void * result;
+    CHECK(list_pipeline_run(pipeline, list, &result) == 0 && NUM(result) == 300);
+    CHECK(list_equals(list, values, 10));
+
+    freed_count = 0;
+    freed_sum = 0;
+    CHECK(list_pipeline_run_in_place(pipeline, list, count_free, &result) == 0 && NUM(result) == 300);
+    uintptr_t kept[5] = {20, 40, 60, 80, 100};
+    CHECK(list_equals(list, kept, 5));
+    CHECK(freed_count == 5 && freed_sum == 25);
+    list_pipeline_destroy(pipeline);
+    list_destroy(list, NULL);
+
+    // an element dropped after a map goes to free_func with its mapped value
+    list = list_of(NULL, values, 10);
+    pipeline = list_pipeline_create();
+    CHECK(list != NULL && pipeline != NULL);
+    if (list == NULL || pipeline == NULL) return;
+    CHECK(list_pipeline_map(pipeline, times_ten, NULL) == 0);
+    CHECK(list_pipeline_filter(pipeline, keep_multiple_of_20, NULL) == 0);
+    freed_count = 0;
+    freed_sum = 0;
+    CHECK(list_pipeline_run_in_place(pipeline, list, count_free, NULL) == 0);
+    CHECK(list_equals(list, kept, 5));
+    CHECK(freed_count == 5 && freed_sum == 250);
+    list_pipeline_destroy(pipeline);
+    list_destroy(list, NULL);
+}
+
+static int is_odd(const void *data, void *ctx) {
+    (void)ctx;
+    return NUM(data) % 2 == 1;
+}
+
+static void test_index(void) {
+    LinkedList * list = list_create();
+    CHECK(list != NULL);
+    if (list == NULL) return;
+    for (uintptr_t i = 1; i <= 200; i++) {
+        CHECK(list_add(list, VAL(i)) == 0);
+    }
+    void * data;
+    CHECK(list_find(list, VAL(5), &data) == -1);
+    CHECK(list_index_enable(list, hash_value, equal_values) == 0);
+    CHECK(list_find(list, VAL(5), &data) == 0 && NUM(data) == 5);
+    CHECK(!list_contains(list, VAL(201)));
+
+    // every change keeps the index up to date
+    CHECK(list_remove_at(list, 0, &data) == 0 && !list_contains(list, VAL(1)));
+    CHECK(list_insert_at(list, 10, VAL(500)) == 0 && list_contains(list, VAL(500)));
+    CHECK(list_remove_if(list, is_odd, NULL, NULL) == 99);
+    CHECK(!list_contains(list, VAL(3)) && list_contains(list, VAL(4)) && list_contains(list, VAL(500)));
+    size_t indices[2] = {0, 5};
+    void * items[2] = {VAL(1001), VAL(1003)};
+    CHECK(list_insert_many(list, indices, items, 2) == 0);
+    CHECK(list_contains(list, VAL(1001)) && list_contains(list, VAL(1003)));
+    list_merge_sort(list, compare_values);
+    for (uintptr_t i = 2; i <= 200; i += 2) {
+        CHECK(list_contains(list, VAL(i)));
+    }
+
+    list_index_disable(list);
+    CHECK(list_find(list, VAL(2), &data) == -1);
+    list_destroy(list, NULL);
+
+    // lists in an arena can be indexed as well
+    ListArena * arena = list_arena_create(1024);
+    CHECK(arena != NULL);
+    if (arena == NULL) return;
+    for (int round = 0; round < 3; round++) {
+        LinkedList * arena_list = list_create_in_arena(arena);
+        CHECK(arena_list != NULL && list_index_enable(arena_list, hash_value, equal_values) == 0);
+        if (arena_list == NULL) return;
+        ListHandle handle = 0;
+        for (uintptr_t i = 1; i <= 500; i++) {
+            CHECK(list_add_with_handle(arena_list, VAL(i), &handle) == 0);
+        }
+        CHECK(list_get_handle(arena_list, handle, &data) == 0 && NUM(data) == 500);
+        CHECK(list_contains(arena_list, VAL(250)));
+        list_destroy(arena_list, NULL);
+        list_arena_reset(arena);
+    }
+    list_arena_destroy(arena);
+}
+
+static void test_remove_if(void) {
+    uintptr_t values[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    uintptr_t evens[5] = {0, 2, 4, 6, 8};
+    LinkedList * list = list_of(NULL, values, 10);
+    CHECK(list != NULL);
+    if (list == NULL) return;
+    freed_count = 0;
+    freed_sum = 0;
+    CHECK(list_remove_if(list, is_odd, NULL, count_free) == 5);
+    CHECK(freed_count == 5 && freed_sum == 25 && list_equals(list, evens, 5));
+    // the tail moves back too, adds still go to the end
+    CHECK(list_add(list, VAL(11)) == 0);
+    CHECK(list_remove_if(list, is_odd, NULL, NULL) == 1 && list_equals(list, evens, 5));
+    CHECK(list_remove_if(list, is_odd, NULL, NULL) == 0);
+    list_destroy(list, NULL);
+}
+
+static void test_snapshots(void) {
+    uintptr_t values[20];
+    for (size_t i = 0; i < 20; i++) values[i] = 20 - i;
+    LinkedList * list = list_of(NULL, values, 20);
+    LinkedList * snapshot = list_snapshot(list);
+    CHECK(snapshot != NULL);
+    if (list == NULL || snapshot == NULL) return;
+
+    void * data;
+    CHECK(list_remove_at(list, 3, &data) == 0);
+    CHECK(list_insert_at(list, 0, VAL(100)) == 0);
+    CHECK(list_add(list, VAL(200)) == 0);
+    list_merge_sort(list, compare_values);
+    CHECK(list_size(list) == 21);
+    CHECK(list_equals(snapshot, values, 20));
+
+    // snapshots refuse every change
+    CHECK(list_add(snapshot, VAL(1)) == -1);
+    CHECK(list_insert_at(snapshot, 0, VAL(1)) == -1);
+    CHECK(list_remove_at(snapshot, 0, &data) == -1);
+    CHECK(list_index_enable(snapshot, hash_value, equal_values) == -1);
+
+    // a snapshot of a snapshot sees the same elements
+    LinkedList * nested = list_snapshot(snapshot);
+    CHECK(nested != NULL && list_equals(nested, values, 20));
+
+    // every view hands free_func the elements it holds itself, once nobody else holds them
+    freed_count = 0;
+    list_destroy(nested, count_free);
+    CHECK(freed_count == 0);
+    freed_count = 0;
+    list_destroy(list, count_free);
+    CHECK(freed_count == 21);
+    freed_count = 0;
+    freed_sum = 0;
+    list_destroy(snapshot, count_free);
+    CHECK(freed_count == 20 && freed_sum == 210);
+}
+
+static void test_reclaim(void) {
+    freed_count = 0;
+    for (uintptr_t round = 0; round < 4; round++) {
+        LinkedList * list = list_create();
+        CHECK(list != NULL);
+        if (list == NULL) return;
+        for (uintptr_t i = 0; i < 1000; i++) {
+            CHECK(list_add(list, VAL(i)) == 0);
+        }
+        list_destroy_async(list, count_free);
+    }
+    list_reclaimer_drain();
+    CHECK(freed_count == 4000);
+    list_reclaimer_shutdown();
+
+    // arena lists are destroyed right away, so the arena can go straight after
+    ListArena * arena = list_arena_create(4096);
+    LinkedList * list = arena != NULL ? list_create_in_arena(arena) : NULL;
+    CHECK(list != NULL);
+    if (list == NULL) return;
+    for (uintptr_t i = 0; i < 100; i++) {
+        CHECK(list_add(list, VAL(i)) == 0);
+    }
+    freed_count = 0;
+    list_destroy_async(list, count_free);
+    CHECK(freed_count == 100);
+    list_arena_destroy(arena);
+    list_reclaimer_shutdown();
+}
+
+// Counts what list_destroy_parallel frees, from every thread it runs on, and
+// how much of it away from the calling thread
+static _Atomic size_t parallel_freed = 0;
+static _Atomic size_t parallel_freed_elsewhere = 0;
+static pthread_t parallel_caller;
+
+static void count_free_parallel(void *data) {
+    (void)data;
+    parallel_freed++;
+    if (!pthread_equal(pthread_self(), parallel_caller)) parallel_freed_elsewhere++;
+}
+
+static void test_destroy_parallel(void) {
+    // every thread gets a segment of (nearly) equal length, the caller takes the first
+    size_t sizes[6] = {0, 1, 5, 100, 5000, 100000};
+    size_t elsewhere[6] = {0, 0, 3, 75, 3750, 75000};
+    parallel_caller = pthread_self();
+    for (size_t i = 0; i < 6; i++) {
+        LinkedList * list = list_create();
+        CHECK(list != NULL);
+        if (list == NULL) return;
+        for (size_t j = 0; j < sizes[i]; j++) {
+            CHECK(list_add(list, VAL(j)) == 0);
+        }
+        parallel_freed = 0;
+        parallel_freed_elsewhere = 0;
+        list_destroy_parallel(list, count_free_parallel, 4);
+        CHECK(parallel_freed == sizes[i] && parallel_freed_elsewhere == elsewhere[i]);
+    }
+}
+
+// Builds a list of 3000 values from arg on, for a thread of its own
+static void *build_list(void *arg) {
+    LinkedList * list = list_create();
+    if (list == NULL) return NULL;
+    for (uintptr_t i = 0; i < 3000; i++) {
+        if (list_add(list, VAL(NUM(arg) + i)) != 0) {
+            list_destroy(list, NULL);
+            return NULL;
+        }
+    }
+    return list;
+}
+
+static void test_node_cache(void) {
+    // lists built on other threads are freed here, their nodes pass through the depot
+    for (int round = 0; round < 3; round++) {
+        pthread_t threads[4];
+        int started[4];
+        for (uintptr_t i = 0; i < 4; i++) {
+            started[i] = pthread_create(&threads[i], NULL, build_list, VAL(i * 10000)) == 0;
+            CHECK(started[i]);
+        }
+        for (uintptr_t i = 0; i < 4; i++) {
+            if (!started[i]) continue;
+            void * result;
+            pthread_join(threads[i], &result);
+            LinkedList * list = result;
+            CHECK(list != NULL);
+            if (list == NULL) continue;
+            void * data;
+            CHECK(list_size(list) == 3000);
+            CHECK(list_get_at(list, 2999, &data) == 0 && NUM(data) == i * 10000 + 2999);
+            list_destroy(list, NULL);
+        }
+        list_node_cache_flush();
+    }
+
+    // churn around the cache limits on one thread, nodes come and go in every order
+    for (int round = 0; round < 3; round++) {
+        LinkedList * list = build_list(VAL(0));
+        CHECK(list != NULL);
+        if (list == NULL) return;
+        void * data;
+        for (uintptr_t i = 0; i < 1500; i++) {
+            CHECK(list_remove_at(list, 0, &data) == 0 && NUM(data) == i);
+            if (i % 3 == 0) CHECK(list_add(list, VAL(100000 + i)) == 0);
+        }
+        CHECK(list_size(list) == 2000);
+        CHECK(list_get_at(list, 0, &data) == 0 && NUM(data) == 1500);
+        list_destroy(list, NULL);
+    }
+    list_node_cache_trim();
+}
+
+static void test_arena_stats(void) {
+    ListArena * arena = list_arena_create_huge((size_t)1 << 20);
+    CHECK(arena != NULL);
+    if (arena == NULL) return;
+    LinkedList * list = list_create_in_arena(arena);
+    CHECK(list != NULL);
+    if (list == NULL) return;
+    for (uintptr_t i = 0; i < 100000; i++) {
+        CHECK(list_add(list, VAL(i)) == 0);
+    }
+    ListArenaStats stats;
+    CHECK(list_arena_stats(arena, &stats) == 0);
+    CHECK(stats.blocks >= 1 && stats.used_bytes <= stats.reserved_bytes);
+    CHECK(stats.huge_page_blocks <= stats.mapped_blocks && stats.mapped_blocks <= stats.blocks);
+    // huge pages are only counted inside the arena's own mappings, which are
+    // the blocks rounded up to whole huge pages at most
+    CHECK(stats.huge_page_bytes <= stats.reserved_bytes + stats.mapped_blocks * ((size_t)2 << 20));
+    list_arena_reset(arena);
+    CHECK(list_arena_stats(arena, &stats) == 0 && stats.used_bytes == 0);
+    list_arena_destroy(arena);
+
+    // plain arenas take their blocks from malloc
+    arena = list_arena_create(4096);
+    CHECK(arena != NULL);
+    if (arena == NULL) return;
+    CHECK(list_arena_alloc(arena, 100) != NULL);
+    CHECK(list_arena_stats(arena, &stats) == 0);
+    CHECK(stats.mapped_blocks == 0 && stats.huge_page_bytes == 0 && stats.used_bytes >= 100);
+    CHECK(list_arena_stats(NULL, &stats) == -1);
+    list_arena_destroy(arena);
+}
+
+static uint64_t record_key(const void *data) {
+    return (uint64_t)((const Record *)data)->key;
+}
+
+static void test_sort_by_key(void) {
+    sort_fixture();
+    LinkedList * list = list_of(NULL, sort_original, SORT_COUNT);
+    CHECK(list != NULL && list_sort_by_key(list, record_key) == 0);
+    CHECK(list_equals(list, sort_expected, SORT_COUNT));
+    list_destroy(list, NULL);
+
+    // short lists take a different path
+    uintptr_t values[6] = {UINT32_MAX, 3, 0, (uintptr_t)1 << 40, 3, 1};
+    uintptr_t sorted[6] = {0, 1, 3, 3, UINT32_MAX, (uintptr_t)1 << 40};
+    list = list_of(NULL, values, 6);
+    CHECK(list != NULL && list_sort_by_key(list, value_key) == 0);
+    CHECK(list_equals(list, sorted, 6));
+    list_destroy(list, NULL);
+
+    // keys built from signed and floating point values sort numerically
+    CHECK(list_key_from_int64(-5) < list_key_from_int64(-1));
+    CHECK(list_key_from_int64(-1) < list_key_from_int64(0));
+    CHECK(list_key_from_int64(0) < list_key_from_int64(INT64_MAX));
+    CHECK(list_key_from_double(-2.5) < list_key_from_double(-0.0));
+    CHECK(list_key_from_double(-0.0) < list_key_from_double(0.0));
+    CHECK(list_key_from_double(0.0) < list_key_from_double(1e300));
+}
+
+static void test_insert_many(void) {
+    uintptr_t values[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    LinkedList * list = list_of(NULL, values, 10);
+    CHECK(list != NULL);
+    if (list == NULL) return;
+
+    // every index counts the items inserted before it
+    size_t indices[3] = {0, 11, 5};
+    void * items[3] = {VAL(100), VAL(101), VAL(102)};
+    CHECK(list_insert_many(list, indices, items, 3) == 0);
+    uintptr_t inserted[13] = {100, 0, 1, 2, 3, 102, 4, 5, 6, 7, 8, 9, 101};
+    CHECK(list_equals(list, inserted, 13));
+    size_t bad[1] = {20};
+    CHECK(list_insert_many(list, bad, items, 1) == -1);
+    CHECK(list_equals(list, inserted, 13));
+
+    size_t wanted[4] = {12, 0, 5, 0};
+    void * out[4];
+    CHECK(list_get_many(list, wanted, out, 4) == 0);
+    CHECK(NUM(out[0]) == 101 && NUM(out[1]) == 100 && NUM(out[2]) == 102 && NUM(out[3]) == 100);
+    CHECK(list_get_many(list, bad, out, 1) == -1);
+    list_destroy(list, NULL);
+}
+
+static void test_handles(void) {
+    LinkedList * list = list_create();
+    LinkedList * other = list_create();
+    CHECK(list != NULL && other != NULL);
+    if (list == NULL || other == NULL) return;
+
+    ListHandle handles[30];
+    for (size_t i = 0; i < 30; i++) {
+        CHECK(list_add_with_handle(list, VAL((i * 7) % 30), &handles[i]) == 0);
+    }
+    CHECK(list_add(other, VAL(1)) == 0);
+
+    // handles follow their elements through a sort
+    list_merge_sort(list, compare_values);
+    void * data;
+    for (size_t i = 0; i < 30; i++) {
+        CHECK(list_get_handle(list, handles[i], &data) == 0 && NUM(data) == (i * 7) % 30);
+        CHECK(list_get_handle(other, handles[i], &data) == -1);
+    }
+    CHECK(list_get_handle(list, 0, &data) == -1);
+
+    // insert after the element 5 and remove it again
+    ListHandle inserted;
+    CHECK(list_insert_after_handle(list, handles[5], VAL(1000), &inserted) == 0);
+    CHECK(list_get_at(list, 6, &data) == 0 && NUM(data) == 1000);
+    CHECK(list_remove_handle(list, inserted, &data) == 0 && NUM(data) == 1000);
+    CHECK(list_get_handle(list, inserted, &data) == -1);
+    CHECK(list_remove_handle(list, inserted, &data) == -1);
+
+    // removing by position makes the handle stale too
+    ListHandle head;
+    CHECK(list_handle_at(list, 0, &head) == 0);
+    CHECK(list_remove_at(list, 0, &data) == 0 && NUM(data) == 0);
+    CHECK(list_get_handle(list, head, &data) == -1);
+    CHECK(list_insert_after_handle(list, head, VAL(1), NULL) == -1);
+    CHECK(list_size(list) == 29);
+
+    // removing the tail by handle keeps adds going to the end
+    ListHandle tail;
+    CHECK(list_handle_at(list, 28, &tail) == 0);
+    CHECK(list_remove_handle(list, tail, NULL) == 0);
+    CHECK(list_add(list, VAL(2000)) == 0);
+    CHECK(list_get_at(list, 28, &data) == 0 && NUM(data) == 2000);
+
+    // a merge moves the elements of src, and their handles go stale with it
+    ListHandle moved;
+    CHECK(list_handle_at(other, 0, &moved) == 0);
+    CHECK(list_merge(list, other, compare_values) == 0);
+    CHECK(list_get_handle(other, moved, &data) == -1);
+    CHECK(list_size(list) == 30 && list_size(other) == 0);
+
+    list_destroy(list, NULL);
+    list_destroy(other, NULL);
+}
+
+// Remembers the keys the LRU cache evicts, in order
+static uintptr_t evicted[16];
+static size_t evicted_count = 0;
+
+static void on_evict(void *key, void *value, void *ctx) {
+    (void)value;
+    (void)ctx;
+    if (evicted_count < 16) evicted[evicted_count] = NUM(key);
+    evicted_count++;
+}
+
+static size_t value_cost(const void *key, const void *value) {
+    (void)key;
+    return NUM(value);
+}
+
+static void test_lru_cache(void) {
+    ListLruCache * cache = list_lru_cache_create(3, hash_value, equal_values);
+    CHECK(cache != NULL);
+    if (cache == NULL) return;
+    evicted_count = 0;
+    list_lru_cache_set_evict_callback(cache, on_evict, NULL);
+
+    void * value;
+    CHECK(list_lru_cache_put(cache, VAL(1), VAL(10)) == 0);
+    CHECK(list_lru_cache_put(cache, VAL(2), VAL(20)) == 0);
+    CHECK(list_lru_cache_put(cache, VAL(3), VAL(30)) == 0);
+    // reading 1 makes 2 the least recently used, peeking does not change that
+    CHECK(list_lru_cache_get(cache, VAL(1), &value) == 0 && NUM(value) == 10);
+    CHECK(list_lru_cache_peek(cache, VAL(2), &value) == 0 && NUM(value) == 20);
+    CHECK(list_lru_cache_put(cache, VAL(4), VAL(40)) == 0);
+    CHECK(evicted_count == 1 && evicted[0] == 2);
+    CHECK(list_lru_cache_get(cache, VAL(2), &value) == -1);
+    CHECK(list_lru_cache_size(cache) == 3);
+
+    // a new key pushes out the least recently used, an overwritten pair is let go as well
+    CHECK(list_lru_cache_put(cache, VAL(5), VAL(50)) == 0);
+    CHECK(evicted_count == 2 && evicted[1] == 3);
+    CHECK(list_lru_cache_put(cache, VAL(5), VAL(51)) == 0);
+    CHECK(evicted_count == 3 && evicted[2] == 5);
+    CHECK(list_lru_cache_get(cache, VAL(5), &value) == 0 && NUM(value) == 51);
+
+    // promote, then evict and remove go to the caller, not the callback
+    void * old_key;
+    void * old_value;
+    CHECK(list_lru_cache_promote(cache, VAL(4)) == 0);
+    CHECK(list_lru_cache_promote(cache, VAL(99)) == -1);
+    CHECK(list_lru_cache_evict(cache, &old_key, &old_value) == 0 && NUM(old_key) == 1 && NUM(old_value) == 10);
+    CHECK(list_lru_cache_remove(cache, VAL(4), &old_key, &old_value) == 0 && NUM(old_value) == 40);
+    CHECK(list_lru_cache_remove(cache, VAL(4), NULL, NULL) == -1);
+    CHECK(evicted_count == 3 && list_lru_cache_size(cache) == 1);
+
+    // a cost limit evicts by cost, and refuses a pair that alone is over it
+    CHECK(list_lru_cache_set_cost_limit(cache, 100, value_cost) == 0);
+    CHECK(list_lru_cache_put(cache, VAL(6), VAL(101)) == -1);
+    CHECK(list_lru_cache_put(cache, VAL(6), VAL(40)) == 0);
+    CHECK(list_lru_cache_put(cache, VAL(7), VAL(40)) == 0);
+    CHECK(list_lru_cache_cost(cache) <= 100);
+    CHECK(list_lru_cache_get(cache, VAL(7), &value) == 0);
+    CHECK(list_lru_cache_put(cache, VAL(8), VAL(60)) == 0);
+    CHECK(list_lru_cache_get(cache, VAL(6), &value) == -1);
+    CHECK(list_lru_cache_cost(cache) == 100 && list_lru_cache_size(cache) == 2);
+
+    // destroying hands the rest to the callback
+    size_t before = evicted_count;
+    list_lru_cache_destroy(cache);
+    CHECK(evicted_count == before + 2);
+
+    // replace hands the pair it replaces back, only evictions go to the callback
+    cache = list_lru_cache_create(2, hash_value, equal_values);
+    CHECK(cache != NULL);
+    if (cache == NULL) return;
+    evicted_count = 0;
+    list_lru_cache_set_evict_callback(cache, on_evict, NULL);
+    CHECK(list_lru_cache_replace(cache, VAL(1), VAL(10), &old_key, &old_value) == 0);
+    CHECK(list_lru_cache_replace(cache, VAL(1), VAL(11), &old_key, &old_value) == 1);
+    CHECK(NUM(old_key) == 1 && NUM(old_value) == 10 && evicted_count == 0);
+    CHECK(list_lru_cache_put(cache, VAL(2), VAL(20)) == 0);
+    CHECK(list_lru_cache_replace(cache, VAL(3), VAL(30), &old_key, &old_value) == 0);
+    CHECK(evicted_count == 1 && evicted[0] == 1 && list_lru_cache_size(cache) == 2);
+    list_lru_cache_destroy(cache);
+    CHECK(evicted_count == 3);
+}
+
+#define TRACE_PATH "list_tests_trace.bin"
+
+static void test_record(void) {
+    CHECK(list_record_start(TRACE_PATH) == 0);
+    CHECK(list_record_start(TRACE_PATH) == -1);
+    LinkedList * list = list_create();
+    CHECK(list != NULL);
+    if (list == NULL) {
+        list_record_stop();
+        return;
+    }
+    void * data;
+    list_add(list, VAL(3));
+    list_add(list, VAL(1));
+    list_insert_at(list, 1, VAL(2));
+    list_get_at(list, 2, &data);
+    list_remove_at(list, 0, &data);
+    list_merge_sort(list, compare_values);
+    // calls the library makes on its own are not recorded, the ones the caller makes are
+    list_partial_sort(list, 5, compare_values);
+    ListHandle handle;
+    list_add_with_handle(list, VAL(4), &handle);
+    LinkedList * odd = list_partition(list, keep_even, NULL);
+    list_destroy(odd, NULL);
+    ListIterator * iter = list_iterator_create(list);
+    list_iterator_next(iter, &data);
+    list_iterator_reset(iter);
+    list_iterator_destroy(iter);
+    list_destroy(list, NULL);
+    LinkedList * other = list_create();
+    list_destroy_async(other, NULL);
+    CHECK(list_record_stop() == 0);
+    CHECK(list_record_stop() == -1);
+
+    static const ListRecordOp expected[] = {
+        LIST_RECORD_CREATE, LIST_RECORD_ADD, LIST_RECORD_ADD, LIST_RECORD_INSERT_AT,
+        LIST_RECORD_GET_AT, LIST_RECORD_REMOVE_AT, LIST_RECORD_MERGE_SORT,
+        LIST_RECORD_ADD, LIST_RECORD_DESTROY,
+        LIST_RECORD_ITERATOR_CREATE, LIST_RECORD_ITERATOR_NEXT, LIST_RECORD_ITERATOR_RESET,
+        LIST_RECORD_ITERATOR_DESTROY, LIST_RECORD_DESTROY,
+        LIST_RECORD_CREATE, LIST_RECORD_DESTROY,
+    };
+    size_t expected_count = sizeof(expected) / sizeof(expected[0]);
+    FILE * in = fopen(TRACE_PATH, "rb");
+    CHECK(in != NULL);
+    if (in == NULL) return;
+    CHECK(list_record_read_header(in) == 0);
+    ListRecordEntry entries[32];
+    size_t count = 0;
+    while (count < 32 && list_record_read(in, &entries[count]) == 1) {
+        count++;
+    }
+    fclose(in);
+    remove(TRACE_PATH);
+
+    CHECK(count == expected_count);
+    for (size_t i = 0; i < count && i < expected_count; i++) {
+        CHECK(entries[i].op == expected[i]);
+    }
+    if (count != expected_count) return;
+    // the insert went to index 1 of a list of two, the remove to index 0 of three
+    CHECK(entries[3].arg == 1 && entries[3].size == 2);
+    CHECK(entries[5].arg == 0 && entries[5].size == 3);
+    // the list partition made was never created in the trace, it gets a number of its own
+    CHECK(entries[7].size == 2 && entries[8].list != entries[0].list);
+    CHECK(entries[0].list == entries[13].list && entries[12].list == 0);
+    CHECK(entries[14].list == entries[15].list && entries[14].list != entries[0].list);
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(a, b);
+}
+
+static void test_sort_strings(void) {
+    // strings with long shared prefixes, one of them twice
+    static const char * const words[] = {
+        "prefix_prefix_prefix_b", "prefix_prefix_prefix_a", "prefix_prefix_prefix_", "prefix",
+        "", "zeta", "prefix_prefix_prefix_a", "alpha", "prefix_prefix_prefix_ab", "prefix_",
+    };
+    size_t word_count = sizeof(words) / sizeof(words[0]);
+    const char * sorted_words[sizeof(words) / sizeof(words[0])];
+    LinkedList * list = list_create();
+    CHECK(list != NULL);
+    if (list == NULL) return;
+    for (size_t i = 0; i < word_count; i++) {
+        CHECK(list_add(list, (void *)words[i]) == 0);
+    }
+    CHECK(list_sort_strings(list) == 0);
+    void * data;
+    for (size_t i = 0; i < word_count; i++) {
+        CHECK(list_get_at(list, i, &data) == 0);
+        sorted_words[i] = data;
+    }
+    for (size_t i = 1; i < word_count; i++) {
+        CHECK(compare_strings(sorted_words[i - 1], sorted_words[i]) <= 0);
+    }
+    // the two equal strings keep their order
+    CHECK(sorted_words[5] == words[1] && sorted_words[6] == words[6]);
+    list_destroy(list, NULL);
+}
+
+static size_t bucket_of(const void *data) {
+    return NUM(data) % 4;
+}
+
+static void test_partition(void) {
+    uintptr_t values[13] = {100, 0, 1, 2, 3, 102, 4, 5, 6, 7, 8, 9, 101};
+    LinkedList * list = list_of(NULL, values, 13);
+    CHECK(list != NULL);
+    if (list == NULL) return;
+
+    LinkedList * odd = list_partition(list, keep_even, NULL);
+    uintptr_t even_values[7] = {100, 0, 2, 102, 4, 6, 8};
+    uintptr_t odd_values[6] = {1, 3, 5, 7, 9, 101};
+    CHECK(odd != NULL && list_equals(list, even_values, 7) && list_equals(odd, odd_values, 6));
+    if (odd == NULL) return;
+    // both lists keep working at their ends
+    CHECK(list_add(list, VAL(10)) == 0 && list_add(odd, VAL(11)) == 0);
+
+    LinkedList * buckets[3];
+    CHECK(list_group_by(odd, bucket_of, 3, buckets) == 0);
+    // keys of 3 and more stay behind
+    uintptr_t ones[4] = {1, 5, 9, 101};
+    uintptr_t threes[3] = {3, 7, 11};
+    CHECK(list_size(buckets[0]) == 0 && list_size(buckets[2]) == 0);
+    CHECK(list_equals(buckets[1], ones, 4) && list_equals(odd, threes, 3));
+    for (size_t i = 0; i < 3; i++) list_destroy(buckets[i], NULL);
+    list_destroy(odd, NULL);
+    list_destroy(list, NULL);
+}
+
+#if defined(LIST_TESTS_WRAP_MALLOC)
+// Allocation failures
+//
+// The test binary is linked with --wrap for malloc, calloc, realloc and free,
+// so every allocation the library makes goes through the functions below,
+// which can make them fail and count what is still allocated.
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+// allocations left before they start failing, -1 for no limit
+static _Atomic long allocations_left = -1;
+// allocations made and not freed yet
+static _Atomic long live_allocations = 0;
+
+static int allocation_allowed(void) {
+    if (allocations_left < 0) return 1;
+    if (allocations_left == 0) return 0;
+    allocations_left--;
+    return 1;
+}
+
+void *__wrap_malloc(size_t size) {
+    void * ptr = allocation_allowed() ? __real_malloc(size) : NULL;
+    if (ptr != NULL) live_allocations++;
+    return ptr;
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    void * ptr = allocation_allowed() ? __real_calloc(count, size) : NULL;
+    if (ptr != NULL) live_allocations++;
+    return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    if (!allocation_allowed()) return NULL;
+    void * moved = __real_realloc(ptr, size);
+    if (ptr == NULL && moved != NULL) live_allocations++;
+    return moved;
+}
+
+void __wrap_free(void *ptr) {
+    if (ptr != NULL) live_allocations--;
+    __real_free(ptr);
+}
+
+// Lets allowed allocations through, then fails all the following ones. Empties
+// the node cache first so nodes have to come from malloc too.
+static void fail_allocations_after(long allowed) {
+    list_node_cache_trim();
+    allocations_left = allowed;
+}
+
+// Stops failing allocations
+// returns 1 if the call under test ran out of allocations, 0 if it got all it wanted
+static int stop_failing_allocations(void) {
+    int ran_out = allocations_left == 0;
+    allocations_left = -1;
+    return ran_out;
+}
+
+// far more allocations than any call under test makes
+#define ALLOCATION_ATTEMPTS 1024
+
+// One call under test: builds its input, makes the call with allocations
+// limited, and checks the outcome
+// returns 1 once the call got every allocation it wanted
+typedef int (*AllocationCase)(long allowed);
+
+// Runs a case with 0, 1, 2, ... allocations allowed until it gets all it wants
+static void run_allocation_case(const char *name, AllocationCase test_case) {
+    for (long allowed = 0; allowed < ALLOCATION_ATTEMPTS; allowed++) {
+        if (test_case(allowed)) return;
+    }
+    fprintf(stderr, "%s: still failing after %d allocations\n", name, ALLOCATION_ATTEMPTS);
+    failures++;
+}
+
+static const uintptr_t small_values[12] = {5, 3, 9, 1, 7, 2, 8, 6, 4, 0, 11, 10};
+
+static int create_case(long allowed) {
+    fail_allocations_after(allowed);
+    ListArena * arena = list_arena_create(4096);
+    LinkedList * list = list_create();
+    LinkedList * arena_list = arena != NULL ? list_create_in_arena(arena) : NULL;
+    int done = !stop_failing_allocations();
+    if (arena_list != NULL) CHECK(list_add(arena_list, VAL(1)) == 0 && list_size(arena_list) == 1);
+    if (list != NULL) list_destroy(list, NULL);
+    if (arena != NULL) list_arena_destroy(arena);
+    return done;
+}
+
+static int index_case(long allowed) {
+    LinkedList * list = list_of(NULL, small_values, 12);
+    CHECK(list != NULL);
+    if (list == NULL) return 1;
+    fail_allocations_after(allowed);
+    int result = list_index_enable(list, hash_value, equal_values);
+    int done = !stop_failing_allocations();
+    CHECK(list_contains(list, VAL(7)) == (result == 0));
+    CHECK(list_equals(list, small_values, 12));
+    list_destroy(list, NULL);
+    return done;
+}
+
+static int snapshot_case(long allowed) {
+    LinkedList * list = list_of(NULL, small_values, 12);
+    CHECK(list != NULL);
+    if (list == NULL) return 1;
+    LinkedList * snapshot = list_snapshot(list);
+    CHECK(snapshot != NULL);
+    if (snapshot == NULL) {
+        list_destroy(list, NULL);
+        return 1;
+    }
+    // the first change after a snapshot copies the nodes it touches
+    fail_allocations_after(allowed);
+    int result = list_insert_at(list, 6, VAL(100));
+    int done = !stop_failing_allocations();
+    CHECK(list_size(list) == (result == 0 ? 13u : 12u));
+    CHECK(list_equals(snapshot, small_values, 12));
+    list_destroy(snapshot, NULL);
+    list_destroy(list, NULL);
+    return done;
+}
+
+static int sort_by_key_case(long allowed) {
+    LinkedList * list = list_of(NULL, small_values, 12);
+    CHECK(list != NULL);
+    if (list == NULL) return 1;
+    fail_allocations_after(allowed);
+    int result = list_sort_by_key(list, value_key);
+    int done = !stop_failing_allocations();
+    if (result != 0) CHECK(list_equals(list, small_values, 12));
+    list_destroy(list, NULL);
+    return done;
+}
+
+static int insert_many_case(long allowed) {
+    LinkedList * list = list_of(NULL, small_values, 10);
+    CHECK(list != NULL && list_index_enable(list, hash_value, equal_values) == 0);
+    if (list == NULL) return 1;
+    size_t indices[3] = {0, 4, 12};
+    void * items[3] = {VAL(100), VAL(101), VAL(102)};
+    fail_allocations_after(allowed);
+    int result = list_insert_many(list, indices, items, 3);
+    int done = !stop_failing_allocations();
+    if (result == 0) {
+        CHECK(list_size(list) == 13 && list_contains(list, VAL(101)));
+    } else {
+        CHECK(list_equals(list, small_values, 10) && !list_contains(list, VAL(101)));
+    }
+    list_destroy(list, NULL);
+    return done;
+}
+
+static int add_case(long allowed) {
+    // the ninth element moves the list out of its inline nodes
+    LinkedList * list = list_of(NULL, small_values, 8);
+    CHECK(list != NULL);
+    if (list == NULL) return 1;
+    fail_allocations_after(allowed);
+    int result = list_add(list, VAL(small_values[8]));
+    int done = !stop_failing_allocations();
+    CHECK(list_equals(list, small_values, result == 0 ? 9 : 8));
+    list_destroy(list, NULL);
+    return done;
+}
+
+static int lru_case(long allowed) {
+    ListLruCache * cache = list_lru_cache_create(4, hash_value, equal_values);
+    CHECK(cache != NULL);
+    if (cache == NULL) return 1;
+    for (uintptr_t i = 1; i <= 3; i++) {
+        CHECK(list_lru_cache_put(cache, VAL(i), VAL(i * 10)) == 0);
+    }
+    evicted_count = 0;
+    list_lru_cache_set_evict_callback(cache, on_evict, NULL);
+    fail_allocations_after(allowed);
+    int result = list_lru_cache_put(cache, VAL(4), VAL(40));
+    int done = !stop_failing_allocations();
+    void * value;
+    CHECK(list_lru_cache_size(cache) == (result == 0 ? 4u : 3u) && evicted_count == 0);
+    CHECK(list_lru_cache_peek(cache, VAL(1), &value) == 0 && NUM(value) == 10);
+    list_lru_cache_set_evict_callback(cache, NULL, NULL);
+    list_lru_cache_destroy(cache);
+    return done;
+}
+
+static int partition_case(long allowed) {
+    LinkedList * list = list_of(NULL, small_values, 12);
+    CHECK(list != NULL);
+    if (list == NULL) return 1;
+    fail_allocations_after(allowed);
+    LinkedList * odd = list_partition(list, keep_even, NULL);
+    int done = !stop_failing_allocations();
+    if (odd != NULL) {
+        CHECK(list_size(list) == 6 && list_size(odd) == 6);
+        list_destroy(odd, NULL);
+    } else {
+        CHECK(list_equals(list, small_values, 12));
+    }
+    list_destroy(list, NULL);
+    return done;
+}
+
+// src holds enough elements that the index of dst has to grow for them
+static const uintptr_t merge_evens[6] = {0, 2, 4, 6, 8, 10};
+static const uintptr_t merge_odds[7] = {1, 3, 5, 7, 9, 11, 13};
+
+static int merge_case(long allowed) {
+    LinkedList * dst = list_of(NULL, merge_evens, 6);
+    LinkedList * src = list_of(NULL, merge_odds, 7);
+    CHECK(dst != NULL && src != NULL);
+    if (dst == NULL || src == NULL) return 1;
+    ListHandle handle;
+    CHECK(list_handle_at(src, 6, &handle) == 0);
+    CHECK(list_index_enable(dst, hash_value, equal_values) == 0);
+    fail_allocations_after(allowed);
+    int result = list_merge(dst, src, compare_values);
+    int done = !stop_failing_allocations();
+    void * data;
+    if (result == 0) {
+        CHECK(list_size(dst) == 13 && list_size(src) == 0 && list_contains(dst, VAL(7)));
+    } else {
+        CHECK(list_equals(dst, merge_evens, 6) && list_equals(src, merge_odds, 7));
+        CHECK(list_get_handle(src, handle, &data) == 0 && NUM(data) == 13);
+    }
+    list_destroy(dst, NULL);
+    list_destroy(src, NULL);
+    return done;
+}
+
+static int merge_k_case(long allowed) {
+    LinkedList * lists[3];
+    lists[0] = list_of(NULL, merge_evens, 6);
+    lists[1] = list_of(NULL, merge_odds, 7);
+    lists[2] = list_of(NULL, merge_odds, 7);
+    CHECK(lists[0] != NULL && lists[1] != NULL && lists[2] != NULL);
+    if (lists[0] == NULL || lists[1] == NULL || lists[2] == NULL) return 1;
+    ListHandle handle;
+    CHECK(list_handle_at(lists[2], 0, &handle) == 0);
+    CHECK(list_index_enable(lists[0], hash_value, equal_values) == 0);
+    fail_allocations_after(allowed);
+    int result = list_merge_k(lists, 3, compare_values);
+    int done = !stop_failing_allocations();
+    void * data;
+    if (result == 0) {
+        CHECK(list_size(lists[0]) == 20 && list_size(lists[1]) == 0 && list_size(lists[2]) == 0);
+    } else {
+        CHECK(list_equals(lists[0], merge_evens, 6) && list_equals(lists[1], merge_odds, 7));
+        CHECK(list_equals(lists[2], merge_odds, 7));
+        CHECK(list_get_handle(lists[2], handle, &data) == 0 && NUM(data) == 1);
+    }
+    for (size_t i = 0; i < 3; i++) list_destroy(lists[i], NULL);
+    return done;
+}
+
+static void test_allocation_failures(void) {
+    run_allocation_case("list_create", create_case);
+    run_allocation_case("list_index_enable", index_case);
+    run_allocation_case("list_snapshot", snapshot_case);
+    run_allocation_case("list_sort_by_key", sort_by_key_case);
+    run_allocation_case("list_insert_many", insert_many_case);
+    run_allocation_case("list_add", add_case);
+    run_allocation_case("list_lru_cache_put", lru_case);
+    run_allocation_case("list_partition", partition_case);
+    run_allocation_case("list_merge", merge_case);
+    run_allocation_case("list_merge_k", merge_k_case);
+}
+
+// Resetting an arena gives back everything the lists in it took, their index
+// and handle tables included
+static void test_arena_tables(void) {
+    long before = live_allocations;
+    ListArena * arena = list_arena_create(1024);
+    CHECK(arena != NULL);
+    if (arena == NULL) return;
+    for (int round = 0; round < 3; round++) {
+        LinkedList * list = list_create_in_arena(arena);
+        CHECK(list != NULL && list_index_enable(list, hash_value, equal_values) == 0);
+        if (list == NULL) return;
+        ListHandle handle;
+        for (uintptr_t i = 1; i <= 500; i++) {
+            CHECK(list_add_with_handle(list, VAL(i), &handle) == 0);
+        }
+        list_arena_reset(arena);
+    }
+    list_arena_destroy(arena);
+    CHECK(live_allocations == before);
+}
+
+// Lists destroyed by a thread-exit destructor that runs after the node cache's
+// own give their nodes straight back to malloc
+static pthread_key_t exit_key;
+
+static void destroy_on_exit(void *list) {
+    list_destroy(list, NULL);
+}
+
+static void *build_list_for_exit(void *arg) {
+    LinkedList * list = build_list(arg);
+    if (list != NULL) pthread_setspecific(exit_key, list);
+    return NULL;
+}
+
+static void test_node_cache_exit(void) {
+    // glibc runs the destructors in the order the keys were made, so the node
+    // cache's key has to exist before exit_key does
+    LinkedList * list = build_list(VAL(0));
+    CHECK(list != NULL);
+    if (list == NULL) return;
+    list_destroy(list, NULL);
+    list_node_cache_trim();
+    long before = live_allocations;
+    CHECK(pthread_key_create(&exit_key, destroy_on_exit) == 0);
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, build_list_for_exit, VAL(0)) == 0);
+    pthread_join(thread, NULL);
+    pthread_key_delete(exit_key);
+    list_node_cache_trim();
+    CHECK(live_allocations == before);
+}
+#endif
+
+typedef struct TestCase {
+    const char * name;
+    void (*run)(void);
+} TestCase;
+
+int main(void) {
+    static const TestCase tests[] = {
+        {"model", test_model},
+        {"arena", test_arena},
+        {"merge", test_merge},
+        {"external_sort", test_external_sort},
+        {"partial_sort", test_partial_sort},
+        {"sorted_iterator", test_sorted_iterator},
+        {"pipeline", test_pipeline},
+        {"index", test_index},
+        {"remove_if", test_remove_if},
+        {"snapshots", test_snapshots},
+        {"reclaim", test_reclaim},
+        {"destroy_parallel", test_destroy_parallel},
+        {"node_cache", test_node_cache},
+        {"arena_stats", test_arena_stats},
+        {"sort_by_key", test_sort_by_key},
+        {"insert_many", test_insert_many},
+        {"handles", test_handles},
+        {"lru_cache", test_lru_cache},
+        {"record", test_record},
+        {"sort_strings", test_sort_strings},
+        {"partition", test_partition},
+#if defined(LIST_TESTS_WRAP_MALLOC)
+        {"allocation_failures", test_allocation_failures},
+        {"arena_tables", test_arena_tables},
+        {"node_cache_exit", test_node_cache_exit},
+#endif
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        int before = failures;
+        tests[i].run();
+        printf("%-20s %s\n", tests[i].name, failures == before ? "ok" : "FAILED");
+    }
+    list_node_cache_trim();
+    return failures == 0 ? 0 : 1;
+}
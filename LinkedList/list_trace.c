@@ -0,0 +1,209 @@
+#if !defined(_WIN32)
+// clock_gettime is not part of plain C11
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "linked_list.h"
+#include "linked_list_internal.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Latency tracing
+//
+// Histograms are log-linear: values below 2^TRACE_SUB_BITS get a bucket each,
+// above that every power of two is split into 2^TRACE_SUB_BITS equal buckets.
+// Recording is a handful of relaxed atomic adds, no locks.
+
+#define TRACE_SUB_BITS 4
+#define TRACE_SUB_BUCKETS (1 << TRACE_SUB_BITS)
+#define TRACE_BUCKETS ((64 - TRACE_SUB_BITS + 1) * TRACE_SUB_BUCKETS)
+
+typedef struct TraceHistogram {
+    _Atomic uint64_t buckets[TRACE_BUCKETS];
+    _Atomic uint64_t count;
+    _Atomic uint64_t total;
+    _Atomic uint64_t max;
+} TraceHistogram;
+
+static const char * const op_names[LIST_TRACE_OP_COUNT] = {
+    "list_insert_at",
+    "list_remove_at",
+    "list_get_at",
+    "list_merge_sort",
+};
+
+static TraceHistogram histograms[LIST_TRACE_OP_COUNT];
+static atomic_int enabled = 0;
+static _Atomic uint64_t slow_threshold = 0;
+static _Atomic(ListTraceCallback) slow_callback = NULL;
+static void * _Atomic slow_ctx = NULL;
+
+static uint64_t now_nanoseconds(void) {
+    struct timespec ts;
+#if !defined(_WIN32)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Position of the highest set bit, value must not be 0
+static int highest_bit(uint64_t value) {
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(value);
+#else
+    int bit = 0;
+    while (value >>= 1) bit++;
+    return bit;
+#endif
+}
+
+static size_t bucket_of(uint64_t value) {
+    if (value < TRACE_SUB_BUCKETS) return (size_t)value;
+    int shift = highest_bit(value) - TRACE_SUB_BITS;
+    return (size_t)(shift + 1) * TRACE_SUB_BUCKETS + (size_t)(value >> shift) - TRACE_SUB_BUCKETS;
+}
+
+// Lowest value that lands in bucket
+static uint64_t bucket_low(size_t bucket) {
+    if (bucket < TRACE_SUB_BUCKETS) return bucket;
+    int shift = (int)(bucket / TRACE_SUB_BUCKETS) - 1;
+    return (uint64_t)(bucket % TRACE_SUB_BUCKETS + TRACE_SUB_BUCKETS) << shift;
+}
+
+// Highest value that lands in bucket
+static uint64_t bucket_high(size_t bucket) {
+    if (bucket + 1 == TRACE_BUCKETS) return UINT64_MAX;
+    return bucket_low(bucket + 1) - 1;
+}
+
+// Starts timing a traced call
+// returns the start time, or 0 when tracing is off
+uint64_t list_trace_begin(void) {
+    if (!atomic_load_explicit(&enabled, memory_order_relaxed)) return 0;
+    return now_nanoseconds();
+}
+
+// Records a traced call that list_trace_begin returned start for
+void list_trace_end(ListTraceOp op, uint64_t start) {
+    if (start == 0) return;
+    uint64_t elapsed = now_nanoseconds() - start;
+
+    TraceHistogram * histogram = &histograms[op];
+    atomic_fetch_add_explicit(&histogram->buckets[bucket_of(elapsed)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->total, elapsed, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while (elapsed > max && !atomic_compare_exchange_weak_explicit(&histogram->max, &max, elapsed,
+                                                                   memory_order_relaxed, memory_order_relaxed)) {
+    }
+
+    ListTraceCallback callback = atomic_load(&slow_callback);
+    if (callback != NULL && elapsed > atomic_load_explicit(&slow_threshold, memory_order_relaxed)) {
+        callback(op, elapsed, atomic_load(&slow_ctx));
+    }
+}
+
+// Starts timing calls, keeping what was recorded so far
+void list_trace_enable(void) {
+    atomic_store(&enabled, 1);
+};
+
+// Stops timing calls, the histograms are kept until list_trace_reset
+void list_trace_disable(void) {
+    atomic_store(&enabled, 0);
+};
+
+// Empties all histograms
+void list_trace_reset(void) {
+    for (size_t op = 0; op < LIST_TRACE_OP_COUNT; op++) {
+        TraceHistogram * histogram = &histograms[op];
+        for (size_t i = 0; i < TRACE_BUCKETS; i++) {
+            atomic_store_explicit(&histogram->buckets[i], 0, memory_order_relaxed);
+        }
+        atomic_store_explicit(&histogram->count, 0, memory_order_relaxed);
+        atomic_store_explicit(&histogram->total, 0, memory_order_relaxed);
+        atomic_store_explicit(&histogram->max, 0, memory_order_relaxed);
+    }
+};
+
+// Calls callback (with ctx) for every traced call slower than threshold_ns nanoseconds.
+// Pass NULL to stop. Set it before other threads start making traced calls.
+void list_trace_set_slow_callback(uint64_t threshold_ns, ListTraceCallback callback, void *ctx) {
+    atomic_store(&slow_callback, NULL);
+    atomic_store(&slow_threshold, threshold_ns);
+    atomic_store(&slow_ctx, ctx);
+    atomic_store(&slow_callback, callback);
+};
+
+// Returns how many calls of op were recorded
+uint64_t list_trace_count(ListTraceOp op) {
+    if ((unsigned int)op >= LIST_TRACE_OP_COUNT) return 0;
+    return atomic_load_explicit(&histograms[op].count, memory_order_relaxed);
+};
+
+// Returns the latency in nanoseconds that percentile (0 to 100) of the recorded
+// calls of op stayed at or below, rounded up to the end of its histogram bucket.
+// returns 0 if nothing was recorded
+uint64_t list_trace_percentile(ListTraceOp op, double percentile) {
+    if ((unsigned int)op >= LIST_TRACE_OP_COUNT) return 0;
+    TraceHistogram * histogram = &histograms[op];
+
+    // sum the buckets instead of trusting count, calls may be recorded meanwhile
+    uint64_t total = 0;
+    for (size_t i = 0; i < TRACE_BUCKETS; i++) {
+        total += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+    }
+    if (total == 0) return 0;
+
+    if (percentile < 0) percentile = 0;
+    if (percentile > 100) percentile = 100;
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)total + 0.5);
+    if (rank == 0) rank = 1;
+    if (rank > total) rank = total;
+
+    uint64_t seen = 0;
+    uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    for (size_t i = 0; i < TRACE_BUCKETS; i++) {
+        seen += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+        if (seen >= rank) {
+            // nothing recorded went past max, so do not report more than that
+            uint64_t high = bucket_high(i);
+            return high < max ? high : max;
+        }
+    }
+    return max;
+};
+
+// Writes count, mean, p50, p90, p99, p999 and max of every operation to out,
+// followed by the non-empty histogram buckets when verbose is nonzero
+void list_trace_dump(FILE *out, int verbose) {
+    if (out == NULL) return;
+
+    fprintf(out, "%-16s %12s %10s %10s %10s %10s %10s %12s\n",
+            "operation", "calls", "mean ns", "p50", "p90", "p99", "p999", "max");
+    for (int op = 0; op < LIST_TRACE_OP_COUNT; op++) {
+        TraceHistogram * histogram = &histograms[op];
+        uint64_t count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+        uint64_t total = atomic_load_explicit(&histogram->total, memory_order_relaxed);
+        fprintf(out, "%-16s %12llu %10.0f %10llu %10llu %10llu %10llu %12llu\n", op_names[op],
+                (unsigned long long)count, count > 0 ? (double)total / (double)count : 0.0,
+                (unsigned long long)list_trace_percentile(op, 50),
+                (unsigned long long)list_trace_percentile(op, 90),
+                (unsigned long long)list_trace_percentile(op, 99),
+                (unsigned long long)list_trace_percentile(op, 99.9),
+                (unsigned long long)atomic_load_explicit(&histogram->max, memory_order_relaxed));
+
+        if (!verbose) continue;
+        for (size_t i = 0; i < TRACE_BUCKETS; i++) {
+            uint64_t bucket_count = atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+            if (bucket_count == 0) continue;
+            fprintf(out, "    %12llu .. %-12llu %llu\n", (unsigned long long)bucket_low(i),
+                    (unsigned long long)bucket_high(i), (unsigned long long)bucket_count);
+        }
+    }
+};
@@ -0,0 +1,51 @@
+#ifndef LIST_TRACE_H
+#define LIST_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Optional latency tracing of the positional list operations and the sort.
+// While enabled every call is timed and counted in a log-linear histogram per
+// operation (16 buckets per power of two, so within about 6% of the real value),
+// which gives tail latencies rather than just averages. Disabled it costs one
+// branch per call. Tracing is safe to use from several threads at once.
+
+// The operations that are traced
+typedef enum ListTraceOp {
+    LIST_TRACE_INSERT_AT,
+    LIST_TRACE_REMOVE_AT,
+    LIST_TRACE_GET_AT,
+    LIST_TRACE_MERGE_SORT,
+    LIST_TRACE_OP_COUNT
+} ListTraceOp;
+
+// Called for every traced call that takes longer than the threshold,
+// with the operation and how long it took
+typedef void (*ListTraceCallback)(ListTraceOp op, uint64_t nanoseconds, void *ctx);
+
+// Starts timing calls, keeping what was recorded so far
+void list_trace_enable(void);
+
+// Stops timing calls, the histograms are kept until list_trace_reset
+void list_trace_disable(void);
+
+// Empties all histograms
+void list_trace_reset(void);
+
+// Calls callback (with ctx) for every traced call slower than threshold_ns nanoseconds.
+// Pass NULL to stop. Set it before other threads start making traced calls.
+void list_trace_set_slow_callback(uint64_t threshold_ns, ListTraceCallback callback, void *ctx);
+
+// Returns how many calls of op were recorded
+uint64_t list_trace_count(ListTraceOp op);
+
+// Returns the latency in nanoseconds that percentile (0 to 100) of the recorded
+// calls of op stayed at or below, rounded up to the end of its histogram bucket.
+// returns 0 if nothing was recorded
+uint64_t list_trace_percentile(ListTraceOp op, double percentile);
+
+// Writes count, mean, p50, p90, p99, p999 and max of every operation to out,
+// followed by the non-empty histogram buckets when verbose is nonzero
+void list_trace_dump(FILE *out, int verbose);
+
+#endif //LIST_TRACE_H